@@ -10,18 +10,41 @@
 
 #endif // end !POPCNT
 
+// the target pragmas do not define the feature macros: record what the code may use
+#if !defined(__POPCNT__) || defined(__BMI2__)
+#define HAS_BMI2
+#endif
+#if !defined(__POPCNT__) || defined(__AVX2__)
+#define HAS_AVX2
+#endif
+
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <cfloat>
+#include <climits>
 #include <random>
 #include <cstdlib>
 #include <ctime>
 #include <iomanip>
 #include <cstring>
+#include <new>
+#include <algorithm>
+#include <immintrin.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define int128(x) static_cast<__int128_t>(x)
 #define FULL_ONE_MASK ~(int128(0x7fffffffffff) << 81)
-#define random(min, max) min + rand() % (max - min)
 #define actionIndex(am) int(int128_ffs(am) - 1)
 #define actionMask(ai) (int128(1) << ai)
 
@@ -84,38 +107,129 @@ typedef __int16_t Mask16;
 
 */
 
-int stateId = 0;
-
-// uint64_t shuffle_table[2] = {static_cast<uint64_t>(time(NULL)), static_cast<uint64_t>(time(NULL)) >> 16};
-// uint64_t random(int min, int max) {
-// 	uint64_t s1 = shuffle_table[0];
-// 	uint64_t s0 = shuffle_table[1];
-// 	uint64_t result = s0 + s1;
-// 	shuffle_table[0] = s0;
-// 	s1 ^= s1 << 23;
-// 	shuffle_table[1] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
-// 	return min + result % (max - min);
-// }
+// maximum number of State living at the same time in the pool, unless --memory sets a budget
+#define POOL_SIZE (1 << 21)
+
+/*
+	Random generator of test_rand.cpp, as an object so that each thread owns one.
+	The state is seeded with SplitMix64, so any seed (even 0) gives a valid state,
+	and a stream index gives each thread its own sequence for the same seed.
+*/
+struct Xoroshiro128 {
+	uint64_t shuffle_table[2];
+
+	Xoroshiro128(uint64_t seed = time(NULL)) { setSeed(seed); }
+
+	void setSeed(uint64_t seed, uint64_t stream = 0) {
+		uint64_t t = seed + stream * UINT64_C(0xD1B54A32D192ED03);
+		for (int i = 0; i < 2; i++) {
+			uint64_t z = (t += UINT64_C(0x9E3779B97F4A7C15));
+			z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+			z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+			shuffle_table[i] = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t next() {
+		uint64_t s1 = shuffle_table[0];
+		uint64_t s0 = shuffle_table[1];
+		uint64_t result = s0 + s1;
+		shuffle_table[0] = s0;
+		s1 ^= s1 << 23;
+		shuffle_table[1] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+		return result;
+	}
+
+	// unbiased integer in [0, range) by multiply-shift, rejecting the few biased draws
+	uint32_t bounded(uint32_t range) {
+		uint64_t m = (next() >> 32) * range;
+		uint32_t low = m;
+		if (low < range) {
+			uint32_t threshold = -range % range;
+			while (low < threshold) {
+				m = (next() >> 32) * range;
+				low = m;
+			}
+		}
+		return m >> 32;
+	}
+};
 
+// one generator per thread, seeded by setSeed() where the thread starts
+thread_local Xoroshiro128 rng;
+
+// wall clock: clock() would count the CPU time of every search thread
 struct Timer {
-	clock_t time_point;
+	chrono::steady_clock::time_point time_point;
 
 	Timer() { set(); }
 
-	void set() { time_point = clock(); }
+	void set() { time_point = chrono::steady_clock::now(); }
 
 	double diff(bool reset = true) {
-		clock_t next_time_point = clock();
-		clock_t tick_diff = next_time_point - time_point;
-		double diff = (double)(tick_diff) / CLOCKS_PER_SEC * 1000;
+		chrono::steady_clock::time_point next_time_point = chrono::steady_clock::now();
+		double diff = chrono::duration<double, milli>(next_time_point - time_point).count();
 		if (reset)
 			time_point = next_time_point;
 		return diff;
 	}
 } timer;
 
+/*
+	Deadline of a search, checked every iteration but read from the clock only every
+	interval checks. The interval adapts so that the clock is read every 50 to 200
+	microseconds, whatever an iteration costs.
+	With earlyStop, the search may end before the deadline once its result is settled:
+	after each clock read, elapsedTime and leftTime tell how long it ran and would still run.
+*/
+struct Deadline {
+	chrono::steady_clock::time_point begin;
+	chrono::steady_clock::time_point end;
+	chrono::steady_clock::time_point last;
+	int interval;
+	int countdown;
+	bool earlyStop;
+	bool read;
+	double elapsedTime;
+	double leftTime;
+
+	Deadline(Timer start, float timeout, bool __earlyStop = false) :
+		begin(start.time_point),
+		end(start.time_point + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(timeout))),
+		last(start.time_point),
+		interval(1),
+		countdown(1),
+		earlyStop(__earlyStop),
+		read(false),
+		elapsedTime(0),
+		leftTime(timeout) {}
+
+	bool expired() {
+		read = false;
+		if (--countdown > 0)
+			return false;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now >= end)
+			return true;
+		read = true;
+		elapsedTime = chrono::duration<double, milli>(now - begin).count();
+		leftTime = chrono::duration<double, milli>(end - now).count();
+		double elapsed = chrono::duration<double, micro>(now - last).count();
+		last = now;
+		if (elapsed < 50 && interval < 1024)
+			interval *= 2;
+		else if (elapsed > 200 && interval > 1)
+			interval /= 2;
+		countdown = interval;
+		return false;
+	}
+};
+
 const Mask128 fullOneMask = ~(int128(0x7fffffffffff) << 81);
 
+// first cell of every small board: times a 9 bits pattern, the pattern in every small board
+const Mask128 firstCells = int128(0x8040201008040201) | int128(0x100) << 64;
+
 const int gameIndexToStrIndex[81] = {
 	0,2,4,22,24,26,44,46,48,
 	8,10,12,30,32,34,52,54,56,
@@ -164,6 +278,146 @@ uint_fast8_t int128_popcount(__int128_t n) {
 	return cnt_lo + cnt_hi;
 }
 
+// index of the n-th (counting from 0) set bit of mask
+int uint64_select(uint64_t mask, int n) {
+#ifdef HAS_BMI2
+	// deposit a single bit on the n-th set bit of mask
+	return __builtin_ctzll(_pdep_u64(uint64_t(1) << n, mask));
+#else
+	// clear the n lowest set bits
+	for (int i = 0; i < n; i++)
+		mask &= mask - 1;
+	return __builtin_ctzll(mask);
+#endif
+}
+
+int int128_select(__int128_t n, int i) {
+	const uint64_t lo = n;
+	const int cnt_lo = __builtin_popcountll(lo);
+	return i < cnt_lo ? uint64_select(lo, i) : 64 + uint64_select(n >> 64, i - cnt_lo);
+}
+
+const int winMask[8] = {0x7,0x38,0x1c0,0x49,0x92,0x124,0x111,0x54};
+
+/*
+	Small board knowledge computed at compile time.
+	The first three tables are indexed by the 9 bits occupancy of one player on a
+	small board (the big boards use the same layout):
+	- win:          the occupancy contains a line
+	- winningCells: cells that would complete a line (not masked by the free cells)
+	- winnable:     the other player can still complete a line despite this occupancy
+	The last two are indexed by the cell index in Mask128:
+	- cellBoard:    mask of the small board containing the cell
+	- routing:      mask of the small board where the opponent is sent after the cell is played
+*/
+struct SmallBoardTable {
+	bool win[512];
+	uint16_t winningCells[512];
+	bool winnable[512];
+	Mask128 cellBoard[81];
+	Mask128 routing[81];
+};
+
+constexpr SmallBoardTable makeSmallBoardTable() {
+	SmallBoardTable table = {};
+	for (int board = 0; board < 512; board++) {
+		for (int i = 0; i < 8; i++) {
+			if ((board & winMask[i]) == winMask[i])
+				table.win[board] = true;
+			// one cell missing to complete the line
+			int missing = winMask[i] & ~board;
+			if (missing && !(missing & (missing - 1)))
+				table.winningCells[board] |= missing;
+			if (!(board & winMask[i]))
+				table.winnable[board] = true;
+		}
+	}
+	for (int cell = 0; cell < 81; cell++) {
+		table.cellBoard[cell] = int128(0x1ff) << (cell / 9 * 9);
+		table.routing[cell] = int128(0x1ff) << (cell % 9 * 9);
+	}
+	return table;
+}
+
+constexpr SmallBoardTable smallBoardTable = makeSmallBoardTable();
+
+/*
+	Zobrist keys computed at compile time with SplitMix64.
+	A position is hashed from the cells of each player, the player to move and the
+	small board the last action sends to (9 before the first action), which together
+	fix the valid actions.
+*/
+struct ZobristTable {
+	uint64_t cell[2][81]; // [myTurn of the player owning the cell][cell]
+	uint64_t route[10];
+	uint64_t side;
+};
+
+constexpr uint64_t splitMix64(uint64_t &state) {
+	uint64_t z = (state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+constexpr ZobristTable makeZobristTable() {
+	ZobristTable table = {};
+	uint64_t state = 0x5A0B;
+	for (int player = 0; player < 2; player++)
+		for (int cell = 0; cell < 81; cell++)
+			table.cell[player][cell] = splitMix64(state);
+	for (int i = 0; i < 10; i++)
+		table.route[i] = splitMix64(state);
+	table.side = splitMix64(state);
+	return table;
+}
+
+constexpr ZobristTable zobrist = makeZobristTable();
+
+/*
+	The 8 symmetries of the square, applied to the whole grid of 81 cells: they map the
+	small boards onto each other and the cells of each small board alike.
+	0 identity, 1-3 rotations of a quarter turn, 4-7 reflections.
+	- cell:    image of a cell index
+	- compose: symmetry applying [b] then [a]
+	- inverse: symmetry undoing [a]
+*/
+struct SymmetryTable {
+	uint8_t cell[8][81];
+	uint8_t compose[8][8];
+	uint8_t inverse[8];
+};
+
+constexpr SymmetryTable makeSymmetryTable() {
+	SymmetryTable table = {};
+	for (int cell = 0; cell < 81; cell++) {
+		int row = cell / 27 * 3 + cell % 9 / 3;
+		int col = cell / 9 % 3 * 3 + cell % 3;
+		int image[8][2] = {
+			{row, col}, {col, 8 - row}, {8 - row, 8 - col}, {8 - col, row},
+			{row, 8 - col}, {8 - row, col}, {col, row}, {8 - col, 8 - row}
+		};
+		for (int s = 0; s < 8; s++)
+			table.cell[s][cell] = image[s][0] / 3 * 27 + image[s][1] / 3 * 9 + image[s][0] % 3 * 3 + image[s][1] % 3;
+	}
+	for (int a = 0; a < 8; a++) {
+		for (int b = 0; b < 8; b++) {
+			for (int c = 0; c < 8; c++) {
+				bool same = true;
+				for (int cell = 0; cell < 81; cell++)
+					same = same && table.cell[c][cell] == table.cell[a][table.cell[b][cell]];
+				if (same)
+					table.compose[a][b] = c;
+			}
+			if (table.compose[a][b] == 0)
+				table.inverse[a] = b;
+		}
+	}
+	return table;
+}
+
+constexpr SymmetryTable symmetry = makeSymmetryTable();
+
 template<class Mask>
 string mtos(Mask mask, size_t size) {
 	string str;
@@ -188,6 +442,7 @@ struct Game {
 	int validActionCount;
 	int validActionComputed;
 	int depth;
+	uint64_t hash;
 
 	Game() {};
 	Game(Mask16 _myBigBoard, Mask16 _oppBigBoard, Mask128 _myBoard, Mask128 _oppBoard, int _myTurn, Mask128 _lastAction, int _depth) :
@@ -202,6 +457,7 @@ struct Game {
 		validActionComputed(false),
 		depth(_depth) {
 			computeValidAction();
+			computeHash();
 		}
 
 	Game(const Game &src) :
@@ -215,7 +471,8 @@ struct Game {
 		lastAction(src.lastAction),
 		validActionCount(src.validActionCount),
 		validActionComputed(src.validActionComputed),
-		depth(src.depth) {}
+		depth(src.depth),
+		hash(src.hash) {}
 
 	Game &operator=(const Game &src) {
 		myBigBoard = src.myBigBoard;
@@ -229,6 +486,7 @@ struct Game {
 		validActionCount = src.validActionCount;
 		validActionComputed = src.validActionComputed;
 		depth = src.depth;
+		hash = src.hash;
 		return *this;
 	}
 
@@ -240,17 +498,24 @@ struct Game {
 
 	int firstActionIndex(Mask128 mask) { return int128_ffs(validAction) - 1; }
 
+	// index of the small board the last action sends to, 9 before the first action
+	int routeIndex() { return lastAction == -1 ? 9 : actionIndex(lastAction) % 9; }
+
+	// full hash of the position, play() then updates it incrementally
+	void computeHash() {
+		hash = zobrist.route[routeIndex()] ^ (myTurn ? zobrist.side : 0);
+		for (int cell = 0; cell < 81; cell++) {
+			if ((myBoard >> cell) & 1)
+				hash ^= zobrist.cell[1][cell];
+			if ((oppBoard >> cell) & 1)
+				hash ^= zobrist.cell[0][cell];
+		}
+	}
+
 	template<class Mask>
 	int boardIsFinal(Mask board) {
 		// the board must be at the right of the mask
-		Mask winMask[8] = {0x7,0x38,0x1c0,0x49,0x92,0x124,0x111,0x54};
-
-		for (size_t i = 0; i < 8; i++) {
-			// maybe test "!(winMask[i] ^ (board & winMask))" to see if it's faster
-			if (winMask[i] == (board & winMask[i]))
-				return 1;
-		}
-		return 0;
+		return smallBoardTable.win[int(board) & 0x1ff];
 	}
 
 	void computeValidAction() {
@@ -269,7 +534,7 @@ struct Game {
 		// get valid action by filtering only the free cells in the small board where you are forced to play
 		// but if there is no last action: juste play in the middle
 		// cerr << "action index = " << actionIndex(lastAction) << endl;
-		Mask128 forcePlay = (lastAction == -1 ? int128(1) << 40 : smallBoardMask(actionIndex(lastAction) % 9));
+		Mask128 forcePlay = (lastAction == -1 ? int128(1) << 40 : smallBoardTable.routing[actionIndex(lastAction)]);
 		// cerr << "forcePlay    = " << mtos(forcePlay, 81) << endl;
 		validAction = freeCellMask & forcePlay;
 		// cerr << "validAction  = " << mtos(validAction, 81) << endl;
@@ -298,22 +563,11 @@ struct Game {
 		return validActionCount;
 	}
 
-	Mask128 randAction() {
+	Mask128 randAction(Xoroshiro128 &rng) {
 		// cerr << "rand action" << endl;
-		int randIndex = validActionCount == 1 ? 0 : random(0, validActionCount - 1);
-		// get past trailing zero
-		Mask128 action = int128(1) << firstActionIndex(validAction);
-		// loop there is still a 1 (e.i. an action)
-		// log();
-		// cerr << "randIndex = " << randIndex << ", action = " << actionIndex(action) << endl;
-		// cerr << mtos(validAction, 81) << endl;
-		// cerr << mtos(action, 81) << endl;
-		while (randIndex > 0 || !(action & validAction)) {
-			randIndex -= action & validAction ? 1 : 0;
-			action <<= 1;
-		}
-		// cerr << "action send  = " << mtos(action, 81) << endl;
-		return action;
+		int randIndex = validActionCount == 1 ? 0 : rng.bounded(validActionCount);
+		// jump directly to the randIndex-th valid action
+		return actionMask(int128_select(validAction, randIndex));
 	}
 
 	template<class T>
@@ -328,7 +582,9 @@ struct Game {
 		// cerr << "Play" << endl;
 		// cerr << "action is    = " << mtos(action, 81) << endl;
 
-		int smallBoardIndex = (int128_ffs(action) - 1) / 9;
+		int cell = actionIndex(action);
+		int smallBoardIndex = cell / 9;
+		hash ^= zobrist.route[routeIndex()] ^ zobrist.route[cell % 9] ^ zobrist.cell[myTurn][cell] ^ zobrist.side;
 
 		Mask128 &workingBoard = myTurn ? myBoard : oppBoard;
 		Mask16 &workingBigBoard = myTurn ? myBigBoard : oppBigBoard;
@@ -345,7 +601,10 @@ struct Game {
 		int result = boardIsFinal(getUniqueSmallBoard(workingBoard, smallBoardIndex));
 		if (result) {
 			workingBigBoard |= result << smallBoardIndex;
-			nonFreeCell |= smallBoardMask(smallBoardIndex);
+			nonFreeCell |= smallBoardTable.cellBoard[cell];
+			// the big board is won: no cell is free anymore, so final() is true
+			if (boardIsFinal(workingBigBoard))
+				nonFreeCell = fullOneMask;
 		}
 		nonFreeCell |= action;
 
@@ -357,8 +616,200 @@ struct Game {
 		computeValidAction();
 	}
 
-	bool final() {
-		return validActionCount == 0 || boardIsFinal(myBigBoard) || boardIsFinal(oppBigBoard);
+	// a won big board leaves no valid action (see play())
+	bool final() { return validActionCount == 0; }
+
+	// cells still playable by someone: a bound on the plies left
+	int emptyCellCount() { return int128_popcount(~nonFreeCell & fullOneMask); }
+
+	/*
+		Cells completing a line of their small board next to two cells of board, every small
+		board at once: for each place in a small board, the two other cells of each of its lines
+		are shifted onto it. The cells of the finished small boards must be masked out.
+	*/
+	static Mask128 lineCompletions(Mask128 board) {
+		return
+			// rows, from their first, second and third column
+			(board >> 1 & board >> 2 & firstCells * 0x49) |
+			(board << 1 & board >> 1 & firstCells * 0x92) |
+			(board << 1 & board << 2 & firstCells * 0x124) |
+			// columns, from their first, second and third row
+			(board >> 3 & board >> 6 & firstCells * 0x7) |
+			(board << 3 & board >> 3 & firstCells * 0x38) |
+			(board << 3 & board << 6 & firstCells * 0x1c0) |
+			// diagonals, the center being on both
+			(board >> 4 & board >> 8 & firstCells) |
+			(board >> 2 & board >> 4 & firstCells << 2) |
+			(((board << 4 & board >> 4) | (board << 2 & board >> 2)) & firstCells << 4) |
+			(board << 2 & board << 4 & firstCells << 6) |
+			(board << 4 & board << 8 & firstCells << 8);
+	}
+
+	// cells of the small boards in bigBoard
+	static Mask128 boardCells(int bigBoard) {
+		Mask128 cells = 0;
+		for (; bigBoard; bigBoard &= bigBoard - 1)
+			cells |= smallBoardTable.cellBoard[__builtin_ctz(bigBoard) * 9];
+		return cells;
+	}
+
+	// valid actions winning a small board for the player to move, or for the other player were it their turn
+	Mask128 smallBoardWinningActions(bool mover = true) {
+		return lineCompletions(myTurn == mover ? myBoard : oppBoard) & validAction;
+	}
+
+	// valid actions completing a line of the big board for the player to move
+	Mask128 winningActions() {
+		Mask128 actions = smallBoardWinningActions();
+		return actions ? actions & boardCells(smallBoardTable.winningCells[myTurn ? myBigBoard : oppBigBoard]) : 0;
+	}
+
+	static Mask128 transform(int s, Mask128 mask) {
+		Mask128 image = 0;
+		for (; mask; mask &= mask - 1)
+			image |= actionMask(symmetry.cell[s][actionIndex(mask)]);
+		return image;
+	}
+
+	// hash of the image of the position by s, whose future is the image of this one
+	uint64_t imageHash(int s) {
+		Game image(*this);
+		image.myBoard = transform(s, myBoard);
+		image.oppBoard = transform(s, oppBoard);
+		if (lastAction != -1)
+			image.lastAction = actionMask(symmetry.cell[s][actionIndex(lastAction)]);
+		image.computeHash();
+		return image.hash;
+	}
+
+	// the image of every cell of mask by s is in mask
+	static bool invariant(int s, Mask128 mask) {
+		for (Mask128 cells = mask; cells; cells &= cells - 1) {
+			if (!((mask >> symmetry.cell[s][actionIndex(cells)]) & 1))
+				return false;
+		}
+		return true;
+	}
+
+	// symmetries leaving the cells of each player and the valid actions unchanged, a bit each: the future is the same
+	int symmetries() {
+		int found = 1;
+		for (int s = 1; s < 8; s++) {
+			if (invariant(s, validAction) && invariant(s, myBoard) && invariant(s, oppBoard))
+				found |= 1 << s;
+		}
+		return found;
+	}
+
+	// one valid action of each class of actions leading to symmetric positions, the lowest
+	Mask128 distinctActions() {
+		int found = symmetries();
+		if (found == 1)
+			return validAction;
+		Mask128 actions = 0;
+		for (Mask128 valid = validAction; valid; valid &= valid - 1) {
+			int action = actionIndex(valid);
+			bool lowest = true;
+			for (int s = 1; s < 8; s++)
+				lowest = lowest && (!((found >> s) & 1) || symmetry.cell[s][action] >= action);
+			if (lowest)
+				actions |= actionMask(action);
+		}
+		return actions;
+	}
+
+	// valid actions sending the opponent to a closed small board, who then plays anywhere
+	Mask128 freeChoiceActions() {
+		Mask128 freeCell = ~nonFreeCell & fullOneMask;
+		Mask128 cells = 0;
+		for (int i = 0; i < 9; i++) {
+			if (!(freeCell & smallBoardTable.cellBoard[i * 9]))
+				cells |= firstCells << i;
+		}
+		return cells & validAction;
+	}
+
+	// cells of the small boards that neither player can win anymore
+	Mask128 deadCells() {
+		Mask128 cells = 0;
+		for (int i = 0; i < 9; i++) {
+			if (!smallBoardTable.winnable[int(myBoard >> (i * 9)) & 0x1ff] && !smallBoardTable.winnable[int(oppBoard >> (i * 9)) & 0x1ff])
+				cells |= smallBoardTable.cellBoard[i * 9];
+		}
+		return cells;
+	}
+
+	/*
+		Actions, valid ones, by decreasing prior, with their priors summing to 1. An action weighs
+		more if it wins a small board or blocks a line of the opponent, and if it is a center
+		or a corner; less if it lets the opponent play anywhere, sends the opponent to a small
+		board where a line is one cell from completion, or is played in a dead small board.
+	*/
+	void orderByPrior(Mask128 valid, uint8_t *actions, float *prior) {
+		Mask128 freeCell = ~nonFreeCell & fullOneMask;
+		Mask128 winning = smallBoardWinningActions();
+		Mask128 blocking = smallBoardWinningActions(false);
+		Mask128 freeChoice = freeChoiceActions();
+		Mask128 dead = deadCells();
+		// the opponent can complete a line in the small board these actions send to
+		Mask128 oppLines = lineCompletions(myTurn ? oppBoard : myBoard) & freeCell;
+		Mask128 toOppLine = 0;
+		for (int i = 0; i < 9; i++) {
+			if (oppLines & smallBoardTable.cellBoard[i * 9])
+				toOppLine |= firstCells << i;
+		}
+		const Mask128 center = firstCells << 4;
+		const Mask128 corner = firstCells * 0x145;
+
+		pair<float, int> weight[81];
+		float sum = 0;
+		int count = 0;
+		for (; valid; valid &= valid - 1) {
+			Mask128 action = valid & -valid;
+			float w = 1;
+			if (action & winning)
+				w *= 4;
+			if (action & blocking)
+				w *= 2;
+			if (action & freeChoice)
+				w *= 0.3;
+			else if (action & toOppLine)
+				w *= 0.5;
+			if (action & dead)
+				w *= 0.5;
+			if (action & center)
+				w *= 1.3;
+			else if (action & corner)
+				w *= 1.1;
+			weight[count++] = make_pair(-w, actionIndex(action));
+			sum += w;
+		}
+		sort(weight, weight + count);
+		for (int i = 0; i < count; i++) {
+			actions[i] = weight[i].second;
+			prior[i] = -weight[i].first / sum;
+		}
+	}
+
+	static Mask128 randCell(Mask128 cells, Xoroshiro128 &rng) {
+		int count = int128_popcount(cells);
+		return actionMask(int128_select(cells, count == 1 ? 0 : rng.bounded(count)));
+	}
+
+	/*
+		Action of the heavy playouts: one winning the game, else one winning a small board,
+		else one blocking a line the opponent would complete, else any valid action.
+	*/
+	Mask128 playoutAction(Xoroshiro128 &rng) {
+		Mask128 winning = smallBoardWinningActions();
+		if (winning) {
+			Mask128 gameWinning = winning & boardCells(smallBoardTable.winningCells[myTurn ? myBigBoard : oppBigBoard]);
+			return randCell(gameWinning ? gameWinning : winning, rng);
+		}
+		Mask128 blocking = smallBoardWinningActions(false);
+		if (blocking)
+			return randCell(blocking, rng);
+		return randAction(rng);
 	}
 
 	float result() {
@@ -418,304 +869,2524 @@ struct Game {
 	}
 };
 
-struct State {
-	float value;
-	int visitCount;
-	Game game;
-	State *parent;
-	State *children[81];
-	int childrenCount;
-	int id;
-
-	State(Game __game, State *__parent) : value(0), visitCount(0), game(__game), parent(__parent), childrenCount(0), id(stateId++) {}
-	~State() {
-		for (size_t i = 0; i < childrenCount; i++)
-			delete children[i];
+/*
+	Packed position of a tree node, half a cache line: the cells of each player, the
+	last action and the player to move, with the hash to find it again. The other
+	fields of a Game (small boards won, free cells, valid actions, depth) are derived
+	from these ones by game().
+*/
+struct alignas(32) Position {
+	uint64_t myLow;
+	uint64_t oppLow;
+	// bits 0-16: cells 64-80 of myBoard, 17-33: cells 64-80 of oppBoard, 34-40: last action (127 before the first one), 41: myTurn
+	uint64_t high;
+	uint64_t hash;
+
+	Position(const Game &game) :
+		myLow(uint64_t(game.myBoard)),
+		oppLow(uint64_t(game.oppBoard)),
+		high(uint64_t(game.myBoard >> 64) |
+			uint64_t(game.oppBoard >> 64) << 17 |
+			uint64_t(game.lastAction == -1 ? 127 : actionIndex(game.lastAction)) << 34 |
+			uint64_t(game.myTurn) << 41),
+		hash(game.hash) {}
+
+	int lastActionIndex() const { return (high >> 34) & 127; }
+
+	int myTurn() const { return (high >> 41) & 1; }
+
+	// index of the small board the last action sends to, 9 before the first action
+	int routeIndex() const { return lastActionIndex() == 127 ? 9 : lastActionIndex() % 9; }
+
+	// same cells, player to move and small board sent to: both games have the same future
+	bool samePosition(const Position &p) const {
+		const uint64_t cellsAndTurn = (uint64_t(1) << 34) - 1 + (uint64_t(1) << 41);
+		return myLow == p.myLow && oppLow == p.oppLow && ((high ^ p.high) & cellsAndTurn) == 0 && routeIndex() == p.routeIndex();
 	}
 
-	State *expand() {
-		// if final state return current state
-		if (game.final())
-			return this;
-
-		// create games for each valid action
-		vector<Game> nextGame;
-		int actionList[81];
-		Game g;
-		game.getActionList(actionList);
-		for (size_t i = 0; i < game.validActionCount; i++) {
-			g = game;
-			// cerr << actionList[i] << endl;
-			g.play(actionMask(actionList[i]));
-			nextGame.push_back(g);
-		}
-		
-		// detect if there is a final state
-		Game *finalGame = NULL;
-		for (size_t i = 0; i < game.validActionCount; i++) {
-			if (nextGame[i].final()) {
-				finalGame = &nextGame[i];
-				break;
-			}
+	Game game() const {
+		Game game;
+		game.myBoard = Mask128(myLow) | Mask128(high & 0x1ffff) << 64;
+		game.oppBoard = Mask128(oppLow) | Mask128((high >> 17) & 0x1ffff) << 64;
+		game.myBigBoard = 0;
+		game.oppBigBoard = 0;
+		game.nonFreeCell = game.myBoard | game.oppBoard;
+		for (int i = 0; i < 9; i++) {
+			if (smallBoardTable.win[int(game.myBoard >> (i * 9)) & 0x1ff])
+				game.myBigBoard |= 1 << i;
+			else if (smallBoardTable.win[int(game.oppBoard >> (i * 9)) & 0x1ff])
+				game.oppBigBoard |= 1 << i;
+			else
+				continue;
+			game.nonFreeCell |= smallBoardTable.cellBoard[i * 9];
 		}
+		// the big board is won: no cell is free anymore (see play())
+		if (smallBoardTable.win[game.myBigBoard] || smallBoardTable.win[game.oppBigBoard])
+			game.nonFreeCell = fullOneMask;
+		game.lastAction = lastActionIndex() == 127 ? Mask128(-1) : actionMask(lastActionIndex());
+		game.myTurn = (high >> 41) & 1;
+		game.depth = int128_popcount(game.myBoard | game.oppBoard);
+		game.hash = hash;
+		game.validActionCount = 0;
+		game.validActionComputed = false;
+		game.computeValidAction();
+		return game;
+	}
+};
 
-		childrenCount = 0;
-		// if there is a final state: expand only this one
-		if (finalGame != NULL) {
-			children[childrenCount++] = new State(*finalGame, this);
-		}
-		// else: expand all next state
-		else {
-			for (size_t i = 0; i < nextGame.size(); i++)
-				children[childrenCount++] = new State(nextGame[i], this);
-		}
-		return children[0];
+#ifdef HAS_AVX2
+
+// rollouts advanced together by a GameBatch
+#define BATCH_LANES 4
+
+/*
+	Independent rollouts advanced together, one ply per step(), with AVX2.
+	Each register holds the same field of the 4 positions (lanes). The cells are split
+	at 63 rather than 64 so that no small board straddles the two words: boards 0 to 6
+	are in [0] and boards 7 and 8 in [1]. Only the random pick of the action is done
+	lane by lane, the play, the small board win checks, the valid actions and the end
+	of the game are computed on the 4 lanes at once. Finished lanes are masked off.
+*/
+struct GameBatch {
+	__m256i myBoard[2];
+	__m256i oppBoard[2];
+	__m256i nonFreeCell[2];
+	__m256i validAction[2];
+	__m256i myBigBoard;
+	__m256i oppBigBoard;
+	__m256i myTurn; // all ones in the lanes where it is my turn
+	__m256i done;   // all ones in the finished lanes
+
+	static uint64_t lo(Mask128 mask) { return uint64_t(mask) & ((uint64_t(1) << 63) - 1); }
+
+	static uint64_t hi(Mask128 mask) { return uint64_t(mask >> 63) & 0x3ffff; }
+
+	static __m256i splat(uint64_t x) { return _mm256_set1_epi64x(x); }
+
+	// cells of a field in one lane, as in Game
+	static Mask128 laneCells(const __m256i field[2], int lane) {
+		alignas(32) uint64_t words[2][BATCH_LANES];
+		_mm256_store_si256((__m256i *)words[0], field[0]);
+		_mm256_store_si256((__m256i *)words[1], field[1]);
+		return Mask128(words[1][lane]) << 63 | words[0][lane];
 	}
 
-	float UCB1() {
-		if (parent == NULL)
-			return -1;
-		
-		if (visitCount == 0)
-			return __builtin_huge_valf();
-		
-		return (value / visitCount) + 2 * sqrt(::log(parent->visitCount) / visitCount);
+	bool laneDone(int lane) {
+		alignas(32) uint64_t laneDone[BATCH_LANES];
+		_mm256_store_si256((__m256i *)laneDone, done);
+		return laneDone[lane] != 0;
 	}
 
-	State *maxUCB1Child() {
-		State *child = NULL;
-		float maxUCB1 = 0;
-		for (size_t i = 0; i < childrenCount; i++) {
-			float UCB1 = children[i]->UCB1();
-			if (UCB1 > maxUCB1) {
-				maxUCB1 = UCB1;
-				child = children[i];
-			}
+	// all ones in the lanes where the 9 bits board contains a line
+	static __m256i lineWin(__m256i board) {
+		__m256i win = _mm256_setzero_si256();
+		for (int i = 0; i < 8; i++) {
+			__m256i mask = splat(winMask[i]);
+			win = _mm256_or_si256(win, _mm256_cmpeq_epi64(_mm256_and_si256(board, mask), mask));
 		}
-		return child;
+		return win;
 	}
 
-	void backpropagate(float __value, State *root) {
-		visitCount++;
-		value += __value;
-		if (parent != NULL && this != root)
-			parent->backpropagate(__value, root);
+	GameBatch(const Game &game) {
+		myBoard[0] = splat(lo(game.myBoard));
+		myBoard[1] = splat(hi(game.myBoard));
+		oppBoard[0] = splat(lo(game.oppBoard));
+		oppBoard[1] = splat(hi(game.oppBoard));
+		nonFreeCell[0] = splat(lo(game.nonFreeCell));
+		nonFreeCell[1] = splat(hi(game.nonFreeCell));
+		validAction[0] = splat(lo(game.validAction));
+		validAction[1] = splat(hi(game.validAction));
+		myBigBoard = splat(uint16_t(game.myBigBoard));
+		oppBigBoard = splat(uint16_t(game.oppBigBoard));
+		myTurn = splat(game.myTurn ? -1 : 0);
+		done = splat(game.validActionCount == 0 ? -1 : 0);
 	}
 
-	float rollout() {
-		Game g = game;
-		while (!g.final()) {
-			g.play(g.randAction());
+	bool allDone() { return _mm256_movemask_epi8(done) == -1; }
+
+	void step(Xoroshiro128 &rng) {
+		alignas(32) uint64_t valid[2][BATCH_LANES];
+		alignas(32) uint64_t laneDone[BATCH_LANES];
+		_mm256_store_si256((__m256i *)valid[0], validAction[0]);
+		_mm256_store_si256((__m256i *)valid[1], validAction[1]);
+		_mm256_store_si256((__m256i *)laneDone, done);
+
+		// pick a random valid action in each running lane
+		alignas(32) uint64_t action[2][BATCH_LANES] = {};
+		alignas(32) uint64_t route[2][BATCH_LANES] = {};
+		alignas(32) uint64_t boardShift[BATCH_LANES] = {};
+		alignas(32) uint64_t bigBit[BATCH_LANES] = {};
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			if (laneDone[lane])
+				continue;
+			int countLo = __builtin_popcountll(valid[0][lane]);
+			int randIndex = rng.bounded(countLo + __builtin_popcountll(valid[1][lane]));
+			int cell = randIndex < countLo ? uint64_select(valid[0][lane], randIndex) : 63 + uint64_select(valid[1][lane], randIndex - countLo);
+			int board = cell / 9;
+			int target = cell % 9;
+			action[board / 7][lane] = uint64_t(1) << (cell - board / 7 * 63);
+			boardShift[lane] = board % 7 * 9;
+			bigBit[lane] = 1 << board;
+			route[target / 7][lane] = uint64_t(0x1ff) << (target % 7 * 9);
 		}
-		return g.result();
+
+		__m256i actionLo = _mm256_load_si256((__m256i *)action[0]);
+		__m256i actionHi = _mm256_load_si256((__m256i *)action[1]);
+		__m256i shift = _mm256_load_si256((__m256i *)boardShift);
+		__m256i inLo = _mm256_xor_si256(_mm256_cmpeq_epi64(actionLo, _mm256_setzero_si256()), splat(-1));
+
+		// play the action on the board of the player to move
+		myBoard[0] = _mm256_or_si256(myBoard[0], _mm256_and_si256(actionLo, myTurn));
+		myBoard[1] = _mm256_or_si256(myBoard[1], _mm256_and_si256(actionHi, myTurn));
+		oppBoard[0] = _mm256_or_si256(oppBoard[0], _mm256_andnot_si256(myTurn, actionLo));
+		oppBoard[1] = _mm256_or_si256(oppBoard[1], _mm256_andnot_si256(myTurn, actionHi));
+
+		// small board where the action was played: won boards are closed and marked on the big board
+		__m256i moverLo = _mm256_blendv_epi8(oppBoard[0], myBoard[0], myTurn);
+		__m256i moverHi = _mm256_blendv_epi8(oppBoard[1], myBoard[1], myTurn);
+		__m256i smallBoard = _mm256_and_si256(_mm256_srlv_epi64(_mm256_blendv_epi8(moverHi, moverLo, inLo), shift), splat(0x1ff));
+		__m256i won = lineWin(smallBoard);
+		__m256i wonBit = _mm256_and_si256(won, _mm256_load_si256((__m256i *)bigBit));
+		myBigBoard = _mm256_or_si256(myBigBoard, _mm256_and_si256(wonBit, myTurn));
+		oppBigBoard = _mm256_or_si256(oppBigBoard, _mm256_andnot_si256(myTurn, wonBit));
+		__m256i closed = _mm256_and_si256(won, _mm256_sllv_epi64(splat(0x1ff), shift));
+		nonFreeCell[0] = _mm256_or_si256(nonFreeCell[0], _mm256_or_si256(actionLo, _mm256_and_si256(closed, inLo)));
+		nonFreeCell[1] = _mm256_or_si256(nonFreeCell[1], _mm256_or_si256(actionHi, _mm256_andnot_si256(inLo, closed)));
+
+		// valid actions of the next player: free cells of the routed small board, or every free cell
+		__m256i bigWon = lineWin(_mm256_blendv_epi8(oppBigBoard, myBigBoard, myTurn));
+		__m256i freeLo = _mm256_andnot_si256(_mm256_or_si256(nonFreeCell[0], _mm256_or_si256(myBoard[0], oppBoard[0])), splat((uint64_t(1) << 63) - 1));
+		__m256i freeHi = _mm256_andnot_si256(_mm256_or_si256(nonFreeCell[1], _mm256_or_si256(myBoard[1], oppBoard[1])), splat(0x3ffff));
+		__m256i validLo = _mm256_and_si256(freeLo, _mm256_load_si256((__m256i *)route[0]));
+		__m256i validHi = _mm256_and_si256(freeHi, _mm256_load_si256((__m256i *)route[1]));
+		__m256i freeChoice = _mm256_cmpeq_epi64(_mm256_or_si256(validLo, validHi), _mm256_setzero_si256());
+		// a won big board leaves no valid action
+		validAction[0] = _mm256_andnot_si256(bigWon, _mm256_blendv_epi8(validLo, freeLo, freeChoice));
+		validAction[1] = _mm256_andnot_si256(bigWon, _mm256_blendv_epi8(validHi, freeHi, freeChoice));
+
+		myTurn = _mm256_xor_si256(myTurn, _mm256_xor_si256(done, splat(-1)));
+		done = _mm256_or_si256(done, _mm256_cmpeq_epi64(_mm256_or_si256(validAction[0], validAction[1]), _mm256_setzero_si256()));
 	}
 
-	State *maxAverageValueChild() {
-		if (childrenCount == 0)
-			return NULL;
-		State *child = children[0];
-		float maxAverageValue = -1;
-		for (size_t i = 0; i < childrenCount; i++) {
-			float averageValue = children[i]->value / children[i]->visitCount;
-			if (averageValue > maxAverageValue) {
-				maxAverageValue = averageValue;
-				child = children[i];
-			}
+	// same as Game::result() for each lane
+	void result(float result[BATCH_LANES]) {
+		alignas(32) uint64_t myBig[BATCH_LANES];
+		alignas(32) uint64_t oppBig[BATCH_LANES];
+		_mm256_store_si256((__m256i *)myBig, myBigBoard);
+		_mm256_store_si256((__m256i *)oppBig, oppBigBoard);
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			int diff = __builtin_popcountll(myBig[lane]) - __builtin_popcountll(oppBig[lane]);
+			if (smallBoardTable.win[myBig[lane]])
+				result[lane] = 1;
+			else if (smallBoardTable.win[oppBig[lane]])
+				result[lane] = 0;
+			else
+				result[lane] = diff > 0 ? 1 : diff < 0 ? 0 : 0.5;
 		}
-		return child;
 	}
+};
 
-	void log() {
-		cerr << "State{t=" << setw(7) << left << value <<
-            ",n=" << setw(5) << left << visitCount <<
-            ",av=" << setw(10) << left << value / visitCount <<
-            ",action=" << (game.lastAction != -1 ? indexToPos[actionIndex(game.lastAction)] : "none") <<
-            "}" << endl;
-	}
+#endif // end HAS_AVX2
 
-};
+struct State;
 
-State *opponentPlay(State *state, Mask128 action) {
-	for (size_t i = 0; i < state->childrenCount; i++) {
-		if (action == state->children[i]->game.lastAction)
-			return state->children[i];
+#define NO_STATE UINT32_MAX
+
+// buckets of the transposition table of a pool per State, the table taking the largest power of 2 below
+#define TABLE_BUCKETS_PER_STATE 2
+
+// smallest pool a memory budget must hold
+#define MIN_POOL_CAPACITY 1024
+
+// children entries of a pool for each of its States
+#define CHILDREN_PER_STATE 4
+
+/*
+	Arena owning every State of the tree.
+	Nodes are bump allocated from one block reserved at startup, so expansion
+	never calls malloc, and a whole generation is released at once by clear().
+
+	The children of a State are one contiguous block of entries, referenced by the
+	index of the first entry and a count. An entry holds the index of the child State
+	and the action leading to it. The statistics read by selection (value and
+	visitCount) are kept apart in parallel arrays indexed like the States, so
+	maxUCB1Child() gathers them through a small contiguous array of indexes.
+
+	Children are built lazily: expansion only reserves an entry per valid action and
+	writes its action, in the order the children are built, and the State of a child
+	is built when selection first picks its action. The untried actions of a State
+	are those of its entries past the childrenCount-th.
+
+	The tree is a DAG: a transposition table maps the hash of a position to its
+	State, and an entry reaching a position already in the pool points to that State.
+
+	With RAVE, an entry also holds the all-moves-as-first statistics of its action,
+	and with PUCT the prior of its action, in parallel arrays only allocated then.
+*/
+struct StatePool {
+	State *nodes;
+	float *value;
+	int *visitCount;
+	uint32_t capacity;
+	uint32_t size;
+	uint32_t *children;
+	uint8_t *childAction;
+	uint32_t childrenCapacity;
+	uint32_t childrenSize;
+	float *raveValue;
+	int *raveCount;
+	float *prior;
+	uint32_t tableSize;
+	uint32_t *table;
+	uint32_t transpositionCount;
+	uint32_t *forward;
+
+	StatePool(uint32_t _capacity);
+	~StatePool();
+
+	static uint32_t tableSizeFor(uint32_t capacity) { return uint32_t(1) << (63 - __builtin_clzll(uint64_t(capacity) * TABLE_BUCKETS_PER_STATE)); }
+
+	bool full(uint32_t count) { return size + count > capacity; }
+
+	bool childrenFull(uint32_t count) { return childrenSize + count > childrenCapacity; }
+
+	// reserve count contiguous nodes and return the index of the first one, NO_STATE if the pool is full
+	uint32_t alloc(uint32_t count) {
+		uint32_t first = __atomic_fetch_add(&size, count, __ATOMIC_RELAXED);
+		return first + count > capacity ? NO_STATE : first;
 	}
-	cerr << "Invalid action " << actionIndex(action) << " in:" << endl;
-	for (size_t i = 0; i < state->childrenCount; i++) {
-		cerr << actionIndex(state->children[i]->game.lastAction) << " ";
+
+	// reserve count contiguous children entries, NO_STATE if the pool is full
+	uint32_t allocChildren(uint32_t count) {
+		uint32_t first = __atomic_fetch_add(&childrenSize, count, __ATOMIC_RELAXED);
+		return first + count > childrenCapacity ? NO_STATE : first;
 	}
-	cerr << endl;
-	state->game.log();
-	exit(1);
-	return state;
-}
 
-void readInput(Mask128 &oppAction, int *validAction) {
-	int opp_row; int opp_col;
-	cin >> opp_row >> opp_col; cin.ignore();
-	if (opp_row == -1)
-		oppAction = 0;
-	else
-		oppAction = int128(1) << posToIndex[opp_row][opp_col];
-	// cerr << mtos(oppAction, 81) << endl;
+	State *create(const Game &game);
 
-	int valid_action_count;
-	cin >> valid_action_count; cin.ignore();
-	for (int i = 0; i < valid_action_count; i++) {
-	    int row; int col;
-	    cin >> row >> col; cin.ignore();
-	    validAction[i] = posToIndex[row][col];
+	// no all-moves-as-first statistics yet for count entries from first
+	void clearRave(uint32_t first, uint32_t count) {
+		if (raveValue == NULL)
+			return;
+		memset(raveValue + first, 0, count * sizeof(float));
+		memset(raveCount + first, 0, count * sizeof(int));
 	}
-}
 
-void generateInput(State *current, Mask128 &oppAction, int *validAction) {
-	oppAction = current->game.randAction();
-}
+	void clear() {
+		size = 0;
+		childrenSize = 0;
+		transpositionCount = 0;
+		memset(table, 0xff, tableSize * sizeof(uint32_t));
+	}
 
-State *mcts(State *initialState, Timer start, float timeout) {
-	State *current;
-    int nbOfSimule = 0;
+	// State of the pool with the same position as game, NULL if none
+	State *find(const Game &game);
 
-	while (true) {
-        double diff = start.diff(false);
-        if (diff > timeout)
-            break;
+	void insert(State *state);
 
-		current = initialState;
+	// release the whole generation and keep only a fresh root for this game
+	State *reroot(const Game &game);
 
-		timer.set();
-		while (current->childrenCount > 0)
-			current = current->maxUCB1Child();
+	// copy what is reachable from root into target and release this whole generation
+	State *promote(State *root, StatePool *target);
 
-		if (current->visitCount > 0)
-			current = current->expand();
+	// visit count from which an expanded State keeps its children, for about keep States and keepChildren entries to remain
+	int recycleThreshold(uint32_t keep, uint32_t keepChildren);
 
-		float value = current->rollout();
+	// compact what is reachable from root in place, dropping the children of the States visited less than threshold times
+	State *recycle(State *root, int threshold);
+};
 
-		current->backpropagate(value, initialState);
+// capacity of each pool, set by --memory
+uint32_t poolCapacity = POOL_SIZE;
 
-        nbOfSimule++;
-	}
-    cerr << "nb of simule = " << nbOfSimule << endl;
-	return initialState->maxAverageValueChild();
-}
+// pool of the tree searched by the calling thread
+thread_local StatePool *pool = NULL;
 
-State *mcts(State *initialState, int maxIter) {
-	State *current;
-    int nbOfSimule = 0;
+// visits of a child at which its RAVE statistics weigh a third of its own, 0 when RAVE is off
+int raveEquivalence = 0;
 
-	while (nbOfSimule < maxIter) {
+// exploration constant of PUCT, 0 when the selection is UCB1
+float puctExploration = 1.5;
 
-		current = initialState;
+// first play urgency: an unvisited child is valued as its parent, less this reduction
+#define FPU_REDUCTION 0.1f
 
-		while (!current->childrenCount)
-			current = current->maxUCB1Child();
+// several threads search the same tree: statistics are updated atomically
+bool sharedTree = false;
 
-		if (current->visitCount > 0)
-			current = current->expand();
+// rollouts take and block the small boards, see Game::playoutAction(); GameBatch plays uniformly, so only light playouts use it
+bool heavyPlayout = true;
 
-		float value = current->rollout();
+void atomicAdd(float &target, float add) {
+	float expected, desired;
+	__atomic_load(&target, &expected, __ATOMIC_RELAXED);
+	do {
+		desired = expected + add;
+	} while (!__atomic_compare_exchange(&target, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
-		current->backpropagate(value, initialState);
+// log of the visit counts of the parents of most selections, the larger ones call logf
+#define LOG_TABLE_SIZE 4096
 
-        nbOfSimule++;
+struct VisitLogTable {
+	float value[LOG_TABLE_SIZE];
+
+	VisitLogTable() {
+		value[0] = 0;
+		for (int i = 1; i < LOG_TABLE_SIZE; i++)
+			value[i] = ::log(i);
 	}
-    cerr << "nb of simule = " << nbOfSimule << endl;
-	return initialState->maxAverageValueChild();
-}
 
-// int main(int ac, char *av[]) {
+	float operator()(int visitCount) const { return visitCount < LOG_TABLE_SIZE ? value[visitCount] : logf(visitCount); }
+} visitLog;
 
-// 	srand(time(NULL));
+#ifdef HAS_AVX2
 
-// 	Game game = Game(0, 0, 0, 0, 0, -1, 0);
+/*
+	Index of the child with the best UCB1 among count, 8 at a time. The statistics of a
+	child are gathered through its index. An unvisited child scores FLT_MAX rather than
+	an infinity, which -ffast-math may assume away, and the first of the best children
+	wins as in the scalar loop: strictly better in each lane, then lowest index across lanes.
+*/
+int maxUCB1Index(const float *value, const int *visitCount, const uint32_t *children, int count, float exploration) {
+	const __m256 unvisited = _mm256_set1_ps(FLT_MAX);
+	const __m256 lowest = _mm256_set1_ps(-FLT_MAX);
+	const __m256 explorationLanes = _mm256_set1_ps(exploration);
+	const __m256i countLanes = _mm256_set1_epi32(count);
+	__m256 best = lowest;
+	__m256i bestIndex = _mm256_setzero_si256();
+	__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (int i = 0; i < count; i += 8) {
+		__m256i active = _mm256_cmpgt_epi32(countLanes, index);
+		__m256i child = _mm256_maskload_epi32((const int *)children + i, active);
+		__m256 childValue = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), value, child, _mm256_castsi256_ps(active), 4);
+		__m256i childVisitCount = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), visitCount, child, active, 4);
+
+		__m256 n = _mm256_cvtepi32_ps(childVisitCount);
+		__m256 score = _mm256_add_ps(_mm256_div_ps(childValue, n), _mm256_sqrt_ps(_mm256_div_ps(explorationLanes, n)));
+		score = _mm256_blendv_ps(score, unvisited, _mm256_castsi256_ps(_mm256_cmpeq_epi32(childVisitCount, _mm256_setzero_si256())));
+		score = _mm256_blendv_ps(lowest, score, _mm256_castsi256_ps(active));
+
+		__m256 better = _mm256_cmp_ps(score, best, _CMP_GT_OQ);
+		best = _mm256_blendv_ps(best, score, better);
+		bestIndex = _mm256_blendv_epi8(bestIndex, index, _mm256_castps_si256(better));
+		index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+	}
+
+	alignas(32) float laneBest[8];
+	alignas(32) int laneIndex[8];
+	_mm256_store_ps(laneBest, best);
+	_mm256_store_si256((__m256i *)laneIndex, bestIndex);
+	int result = laneIndex[0];
+	float resultScore = laneBest[0];
+	for (int lane = 1; lane < 8; lane++) {
+		if (laneBest[lane] > resultScore || (laneBest[lane] == resultScore && laneIndex[lane] < result)) {
+			resultScore = laneBest[lane];
+			result = laneIndex[lane];
+		}
+	}
+	return result;
+}
 
-// 	State *state = new State(game, NULL);
+#endif // end HAS_AVX2
 
-// 	Timer start;
+enum ExpandState : uint8_t { LEAF, EXPANDING, EXPANDED };
 
-// 	State *child = mcts(state, start, 1000);
-// 	cerr << "Simulation time = " << start.diff() << endl;
-// 	// child->game.log();
+// game theoretic value of a State for the player who moved into it
+enum Proof : uint8_t { UNPROVEN, PROVEN_WIN, PROVEN_LOSS, PROVEN_DRAW };
 
-// 	for (size_t i = 0; i < state->game.validActionCount; i++)
-// 		state->children[i]->log();
+// value of a State proven won, negated if proven lost: selection and the move choice need no other test
+#define PROVEN_VALUE 1e9f
 
-// 	// while (!game.final()) {
-// 	// 	cerr << "- NEXT TURN -" << endl;
-// 	// 	game.play(game.randAction());
-// 	// 	string str;
-// 	// 	getline(cin, str);
-// 	// }
+struct State {
+	Position position;
+	uint32_t firstChild;
+	uint8_t actionCount;
+	uint8_t childrenCount;
+	uint8_t expandState;
+	uint8_t building;
+	uint8_t proof;
+
+	// the pool owns the children: a State is never deleted on its own
+	State(const Game &__game) : position(__game), firstChild(NO_STATE), actionCount(0), childrenCount(0), expandState(LEAF), building(false), proof(UNPROVEN) {
+		value() = 0;
+		visitCount() = 0;
+	}
 
-// 	delete state;
-// 	return 0;
-// }
+	uint32_t index() const { return this - pool->nodes; }
 
-int main() {
-	srand(time(NULL));
+	// the position unpacked, its derived fields recomputed
+	Game game() const { return position.game(); }
 
-	Mask128 oppAction;
-	int validAction[81];
+	float &value() { return pool->value[index()]; }
 
-	Game initialGame = Game(0, 0, 0, 0, 0, -1, 0);
-	State *initialState = new State(initialGame, NULL);
+	int &visitCount() { return pool->visitCount[index()]; }
 
-    State *current = initialState;
+	State *child(int i) { return pool->nodes + pool->children[firstChild + i]; }
 
-	int first = true;
-    while (1) {
+	// action leading to the i-th child, built or not
+	Mask128 childAction(int i) { return actionMask(pool->childAction[firstChild + i]); }
 
-		if (current->game.final()) {
-			cerr << "result = " << current->game.result() << endl;
-			delete initialState;
-			return 0;
-		}
+	// the children are published once fully built, so a thread seeing EXPANDED can descend
+	bool expanded() { return __atomic_load_n(&expandState, __ATOMIC_ACQUIRE) == EXPANDED; }
 
-		readInput(oppAction, validAction);
-		// generateInput(current, oppAction, validAction);
-        Timer start;
+	// count a visit as soon as the state is selected: until the value is backpropagated
+	// this is a virtual loss that steers the other threads toward other children
+	void addVirtualLoss() {
+		if (sharedTree)
+			__atomic_fetch_add(&visitCount(), 1, __ATOMIC_RELAXED);
+		else
+			visitCount()++;
+	}
 
-		if (current->game.final()) {
-			cerr << "result = " << current->game.result() << endl;
-			delete initialState;
-			return 0;
+	// reserve an entry per action, no child is built yet: false if the state stays a leaf
+	bool expand() {
+		Game game = this->game();
+		// if final state or no more room in the pool: stay a leaf
+		if (game.final() || pool->childrenFull(game.validActionCount))
+			return false;
+
+		// only one thread expands a leaf, the others roll out from it meanwhile
+		uint8_t leaf = LEAF;
+		if (!__atomic_compare_exchange_n(&expandState, &leaf, EXPANDING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return false;
+
+		// if an action wins the game: expand only this one, else one action of each symmetric class
+		Mask128 winning = game.winningActions();
+		Mask128 actions = winning != 0 ? winning & -winning : game.distinctActions();
+		uint32_t count = int128_popcount(actions);
+		uint32_t first = pool->allocChildren(count);
+		if (first == NO_STATE) {
+			__atomic_store_n(&expandState, LEAF, __ATOMIC_RELEASE);
+			return false;
+		}
+		if (pool->prior != NULL)
+			game.orderByPrior(actions, pool->childAction + first, pool->prior + first);
+		else {
+			uint8_t *action = pool->childAction + first;
+			for (; actions; actions &= actions - 1)
+				*action++ = actionIndex(actions);
 		}
+		pool->clearRave(first, count);
+		firstChild = first;
+		actionCount = count;
+		__atomic_store_n(&expandState, EXPANDED, __ATOMIC_RELEASE);
+		return true;
+	}
 
-		if (first) {
-			if (oppAction != 0)
-				current->game.play(oppAction);
-			else
-				current->game.myTurn = 1;
+	// build the child of the first untried action, NULL if another thread is building one or the pool is full
+	State *buildNextChild() {
+		uint8_t idle = false;
+		if (!__atomic_compare_exchange_n(&building, &idle, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return NULL;
+
+		State *next = NULL;
+		int i = childrenCount;
+		if (i < actionCount) {
+			Game g = game();
+			Mask128 action = childAction(i);
+			g.play(action);
+			next = pool->find(g);
+			if (next != NULL)
+				__atomic_fetch_add(&pool->transpositionCount, 1, __ATOMIC_RELAXED);
+			else {
+				uint32_t index = pool->alloc(1);
+				if (index != NO_STATE) {
+					next = new (pool->nodes + index) State(g);
+					pool->insert(next);
+				}
+			}
+			if (next != NULL) {
+				pool->children[firstChild + i] = next->index();
+				__atomic_store_n(&childrenCount, i + 1, __ATOMIC_RELEASE);
+			}
 		}
-		else {
-			current = opponentPlay(current, oppAction);
+		__atomic_store_n(&building, false, __ATOMIC_RELEASE);
+		return next;
+	}
+
+	// an untried action first, as an unvisited child scores the most, then the best UCB1 of the built children
+	State *selectChild() {
+		if (puctExploration > 0)
+			return selectPUCTChild();
+		if (__atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE) < actionCount) {
+			State *next = buildNextChild();
+			if (next != NULL)
+				return next;
 		}
+		if (__atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE) == 0)
+			return NULL;
+		return maxUCB1Child();
+	}
 
-        current->game.log();
-		// string str;
-		// getline(cin, str);
+	// exploration is 4 * log(parent visits): 2 * sqrt(log(N) / n) is sqrt(4 * log(N) / n)
+	static float UCB1(float value, int visitCount, float exploration) {
+		if (visitCount == 0)
+			return FLT_MAX;
+		
+		return (value / visitCount) + sqrtf(exploration / visitCount);
+	}
 
-        // my play
-        State *child = mcts(current, start, first ? 990 : 90);
+	/*
+		UCB1 with the average value blended with the all-moves-as-first one, whose weight
+		sqrt(k / (3n + k)) decays with the n visits of the child, k being raveEquivalence.
+	*/
+	static float raveAverage(float average, int visitCount, float raveValue, int raveCount) {
+		if (raveCount == 0)
+			return average;
+		float beta = sqrtf(raveEquivalence / (3.f * visitCount + raveEquivalence));
+		return average + beta * (raveValue / raveCount - average);
+	}
+
+	static float raveUCB1(float value, int visitCount, float raveValue, int raveCount, float exploration) {
+		if (visitCount == 0)
+			return FLT_MAX;
+		return raveAverage(value / visitCount, visitCount, raveValue, raveCount) + sqrtf(exploration / visitCount);
+	}
 
-		// for (size_t i = 0; i < current->game.validActionCount; i++)
-		// 	current->children[i]->log();
+	/*
+		PUCT: the average value plus puctExploration * prior * sqrt(N) / (1 + n), N being the
+		visits of this State. An unvisited child is valued by first play urgency rather than
+		infinity, so the untried action of the best prior, the next entry, is built only once
+		it beats the built children.
+	*/
+	State *selectPUCTChild() {
+		const uint32_t *children = pool->children + firstChild;
+		int count = __atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE);
+		int parentVisitCount = visitCount();
+		float sqrtVisitCount = sqrtf(parentVisitCount);
+		// the value of this State is for the other player, and its first visit is not backpropagated yet
+		float fpu = parentVisitCount > 1 ? 1 - value() / (parentVisitCount - 1) - FPU_REDUCTION : 0.5f;
+
+		int best = -1;
+		float maxScore = -FLT_MAX;
+		for (int i = 0; i < count; i++) {
+			uint32_t entry = firstChild + i;
+			int n = pool->visitCount[children[i]];
+			float average = fpu;
+			if (n > 0) {
+				average = pool->value[children[i]] / n;
+				if (raveEquivalence > 0)
+					average = raveAverage(average, n, pool->raveValue[entry], pool->raveCount[entry]);
+			}
+			float score = average + puctExploration * pool->prior[entry] * sqrtVisitCount / (1 + n);
+			if (score > maxScore) {
+				maxScore = score;
+				best = i;
+			}
+		}
+		if (count < actionCount && fpu + puctExploration * pool->prior[firstChild + count] * sqrtVisitCount > maxScore) {
+			State *next = buildNextChild();
+			if (next != NULL)
+				return next;
+		}
+		return best < 0 ? NULL : child(best);
+	}
 
-        cerr << "simule time " << start.diff() << endl;
+	// the statistics may be read while other threads update them: a stale value only biases one selection
+	State *maxUCB1Child() {
+		const uint32_t *children = pool->children + firstChild;
+		int count = __atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE);
+		// once per selection step, not per child
+		float exploration = 4 * visitLog(visitCount());
+
+		if (raveEquivalence > 0) {
+			int best = 0;
+			float maxUCB1 = -FLT_MAX;
+			for (int i = 0; i < count; i++) {
+				uint32_t entry = firstChild + i;
+				float UCB1 = raveUCB1(pool->value[children[i]], pool->visitCount[children[i]], pool->raveValue[entry], pool->raveCount[entry], exploration);
+				if (UCB1 > maxUCB1) {
+					maxUCB1 = UCB1;
+					best = i;
+				}
+			}
+			return child(best);
+		}
 
-        if (child == NULL) {
-            cerr << "mcts did not return any action" << endl;
-            cout << indexToPos[validAction[0]] << endl;
-			current = opponentPlay(current, validAction[0]);
-        }
-        else {
-            cout << indexToPos[actionIndex(child->game.lastAction)] << endl;
-            current = child;
-        }
-        current->game.log();
-        cerr << endl;
-		first = false;
-		// getline(cin, str);
-    }
-}
\ No newline at end of file
+#ifdef HAS_AVX2
+		return child(maxUCB1Index(pool->value, pool->visitCount, children, count, exploration));
+#else
+		State *bestChild = NULL;
+		float maxUCB1 = -1;
+		for (int i = 0; i < count; i++) {
+			float UCB1 = State::UCB1(pool->value[children[i]], pool->visitCount[children[i]], exploration);
+			if (UCB1 > maxUCB1) {
+				maxUCB1 = UCB1;
+				bestChild = child(i);
+			}
+		}
+		return bestChild;
+#endif
+	}
+
+	/*
+		__value is the sum of weight rollout results, mine: a State keeps those of the player
+		who moved into it, whose average its parent maximizes.
+		addVirtualLoss() already counted one visit during the selection.
+	*/
+	void backpropagate(float __value, int weight = 1) {
+		if (position.myTurn())
+			__value = weight - __value;
+		if (sharedTree) {
+			atomicAdd(value(), __value);
+			if (weight > 1)
+				__atomic_fetch_add(&visitCount(), weight - 1, __ATOMIC_RELAXED);
+		}
+		else {
+			value() += __value;
+			visitCount() += weight - 1;
+		}
+	}
+
+	// final game of a rollout, its cells being those played in the tree and in the rollout
+	static Game playout(Game g, Xoroshiro128 &rng) {
+		while (!g.final()) {
+			g.play(heavyPlayout ? g.playoutAction(rng) : g.randAction(rng));
+		}
+		return g;
+	}
+
+	static float rollout(Game g, Xoroshiro128 &rng) { return playout(g, rng).result(); }
+
+	float rollout(Xoroshiro128 &rng) { return rollout(game(), rng); }
+
+	// sum of the results of count rollouts, all with the same policy so that a node never mixes two estimates
+	float rollout(Xoroshiro128 &rng, int count) {
+		Game game = this->game();
+		float value = 0;
+#ifdef HAS_AVX2
+		float result[BATCH_LANES];
+		for (; !heavyPlayout && count >= BATCH_LANES; count -= BATCH_LANES) {
+			GameBatch batch(game);
+			while (!batch.allDone())
+				batch.step(rng);
+			batch.result(result);
+			for (int lane = 0; lane < BATCH_LANES; lane++)
+				value += result[lane];
+		}
+#endif
+		for (; count > 0; count--)
+			value += rollout(game, rng);
+		return value;
+	}
+
+	/*
+		All moves as first: the built children whose action the player to move here played
+		anywhere later in the simulation, myCells and oppCells being the cells at its end,
+		get its result. Their cells are free here, so whoever holds them played them later.
+	*/
+	void updateRave(Mask128 myCells, Mask128 oppCells, float __value) {
+		Mask128 played = position.myTurn() ? myCells : oppCells;
+		float result = position.myTurn() ? __value : 1 - __value;
+		int count = __atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE);
+		for (int i = 0; i < count; i++) {
+			uint32_t entry = firstChild + i;
+			if (!((played >> pool->childAction[entry]) & 1))
+				continue;
+			if (sharedTree) {
+				atomicAdd(pool->raveValue[entry], result);
+				__atomic_fetch_add(&pool->raveCount[entry], 1, __ATOMIC_RELAXED);
+			}
+			else {
+				pool->raveValue[entry] += result;
+				pool->raveCount[entry]++;
+			}
+		}
+	}
+
+	Proof getProof() { return Proof(__atomic_load_n(&proof, __ATOMIC_ACQUIRE)); }
+
+	void prove(Proof __proof) {
+		float provenValue = __proof == PROVEN_WIN ? PROVEN_VALUE : __proof == PROVEN_LOSS ? -PROVEN_VALUE : value();
+		__atomic_store(&value(), &provenValue, __ATOMIC_RELAXED);
+		__atomic_store_n(&proof, __proof, __ATOMIC_RELEASE);
+	}
+
+	// proof of a final game
+	void prove(Game &game) {
+		float result = position.myTurn() ? 1 - game.result() : game.result();
+		prove(result == 1 ? PROVEN_WIN : result == 0 ? PROVEN_LOSS : PROVEN_DRAW);
+	}
+
+	/*
+		Minimax on the proofs of the children, which are for the player to move here:
+		one child won for him and this State is lost for the other player, every child
+		lost and it is won. Every action must have its child built to prove all of them.
+	*/
+	bool proveFromChildren() {
+		if (getProof() != UNPROVEN)
+			return true;
+		if (!expanded())
+			return false;
+		int count = __atomic_load_n(&childrenCount, __ATOMIC_ACQUIRE);
+		bool allProven = count == actionCount;
+		bool allLost = true;
+		for (int i = 0; i < count; i++) {
+			Proof childProof = child(i)->getProof();
+			if (childProof == PROVEN_WIN) {
+				prove(PROVEN_LOSS);
+				return true;
+			}
+			allProven &= childProof != UNPROVEN;
+			allLost &= childProof == PROVEN_LOSS;
+		}
+		if (!allProven)
+			return false;
+		prove(allLost ? PROVEN_WIN : PROVEN_DRAW);
+		return true;
+	}
+
+	/*
+		A root is only proven from its children, the move being chosen among them. A root
+		proven as a leaf of the former tree has none: its proof is dropped for its result,
+		and the search proves it again from the children it builds.
+	*/
+	void reopen() {
+		Proof oldProof = getProof();
+		if (oldProof == UNPROVEN || childrenCount > 0)
+			return;
+		value() = visitCount() * (oldProof == PROVEN_WIN ? 1 : oldProof == PROVEN_LOSS ? 0 : 0.5f);
+		proof = UNPROVEN;
+	}
+
+	// my result of a game reaching this proven State
+	float provenResult() {
+		Proof proof = getProof();
+		float result = proof == PROVEN_WIN ? 1 : proof == PROVEN_LOSS ? 0 : 0.5;
+		return position.myTurn() ? 1 - result : result;
+	}
+
+	State *maxAverageValueChild() {
+		if (childrenCount == 0)
+			return NULL;
+		const uint32_t *children = pool->children + firstChild;
+
+		State *bestChild = child(0);
+		float maxAverageValue = -1;
+		for (size_t i = 0; i < childrenCount; i++) {
+			float averageValue = pool->value[children[i]] / pool->visitCount[children[i]];
+			if (averageValue > maxAverageValue) {
+				maxAverageValue = averageValue;
+				bestChild = child(i);
+			}
+		}
+		return bestChild;
+	}
+
+	State *maxVisitCountChild() {
+		if (childrenCount == 0)
+			return NULL;
+		const uint32_t *children = pool->children + firstChild;
+
+		State *bestChild = child(0);
+		int maxVisitCount = -1;
+		for (size_t i = 0; i < childrenCount; i++) {
+			if (pool->visitCount[children[i]] > maxVisitCount) {
+				maxVisitCount = pool->visitCount[children[i]];
+				bestChild = child(i);
+			}
+		}
+		return bestChild;
+	}
+
+	/*
+		The chosen child leads the visits by more than remainingVisits, the visits the tree
+		will still get: no other child can overtake it. Its average may still move, so a
+		search only stops while the most visited child is also the best by average.
+	*/
+	bool settled(float remainingVisits) {
+		// a proven State has a proven won child, or every child is proven
+		if (getProof() != UNPROVEN)
+			return true;
+		if (!expanded())
+			return false;
+		// the tree only keeps a winning child
+		if (actionCount == 1 && childrenCount == 1)
+			return true;
+		if (childrenCount == 0)
+			return false;
+		// an untried action has no visit
+		const uint32_t *children = pool->children + firstChild;
+		uint32_t best = maxVisitCountChild()->index();
+		if (best != maxAverageValueChild()->index())
+			return false;
+		int otherVisitCount = 0;
+		for (size_t i = 0; i < childrenCount; i++) {
+			if (children[i] != best)
+				otherVisitCount = max(otherVisitCount, pool->visitCount[children[i]]);
+		}
+		return otherVisitCount + remainingVisits < pool->visitCount[best];
+	}
+
+	// the proof of a root, for the player to move
+	void logProof() {
+		static const char *outcome[] = {"", "loss", "win", "draw"};
+		if (getProof() != UNPROVEN)
+			cerr << "proven " << outcome[getProof()] << " for the player to move" << endl;
+	}
+
+	void log() {
+		cerr << "State{t=" << setw(7) << left << value() <<
+            ",n=" << setw(5) << left << visitCount() <<
+            ",av=" << setw(10) << left << value() / visitCount() <<
+            ",action=" << (position.lastActionIndex() != 127 ? indexToPos[position.lastActionIndex()] : "none") <<
+            "}" << endl;
+	}
+
+};
+
+StatePool::StatePool(uint32_t _capacity) :
+	// a State is one cache line
+	nodes(static_cast<State *>(aligned_alloc(64, size_t(_capacity) * sizeof(State)))),
+	value(static_cast<float *>(malloc(size_t(_capacity) * sizeof(float)))),
+	visitCount(static_cast<int *>(malloc(size_t(_capacity) * sizeof(int)))),
+	capacity(_capacity),
+	children(static_cast<uint32_t *>(malloc(size_t(_capacity) * CHILDREN_PER_STATE * sizeof(uint32_t)))),
+	childAction(static_cast<uint8_t *>(malloc(size_t(_capacity) * CHILDREN_PER_STATE * sizeof(uint8_t)))),
+	childrenCapacity(_capacity * CHILDREN_PER_STATE),
+	raveValue(raveEquivalence > 0 ? static_cast<float *>(malloc(size_t(_capacity) * CHILDREN_PER_STATE * sizeof(float))) : NULL),
+	raveCount(raveEquivalence > 0 ? static_cast<int *>(malloc(size_t(_capacity) * CHILDREN_PER_STATE * sizeof(int))) : NULL),
+	prior(puctExploration > 0 ? static_cast<float *>(malloc(size_t(_capacity) * CHILDREN_PER_STATE * sizeof(float))) : NULL),
+	tableSize(tableSizeFor(_capacity)),
+	table(static_cast<uint32_t *>(malloc(tableSize * sizeof(uint32_t)))),
+	forward(static_cast<uint32_t *>(malloc(size_t(_capacity) * sizeof(uint32_t)))) {
+	clear();
+}
+
+StatePool::~StatePool() {
+	free(nodes);
+	free(value);
+	free(visitCount);
+	free(children);
+	free(childAction);
+	free(raveValue);
+	free(raveCount);
+	free(prior);
+	free(table);
+	free(forward);
+}
+
+State *StatePool::create(const Game &game) {
+	State *state = new (nodes + alloc(1)) State(game);
+	insert(state);
+	return state;
+}
+
+State *StatePool::find(const Game &game) {
+	uint32_t i = __atomic_load_n(&table[game.hash & (tableSize - 1)], __ATOMIC_ACQUIRE);
+	// the bucket may hold another position with the same hash bits
+	if (i < size && nodes[i].position.samePosition(Position(game)))
+		return nodes + i;
+	return NULL;
+}
+
+void StatePool::insert(State *state) {
+	__atomic_store_n(&table[state->position.hash & (tableSize - 1)], uint32_t(state - nodes), __ATOMIC_RELEASE);
+}
+
+State *StatePool::reroot(const Game &game) {
+	Game root = game;
+	clear();
+	return create(root);
+}
+
+/*
+	The States reachable from root are copied first, in the order they are found, and
+	forward maps them to their copy in target. Their children blocks are copied next,
+	the entries of the built children mapped through forward and the untried ones only
+	keeping their action.
+*/
+State *StatePool::promote(State *root, StatePool *target) {
+	target->clear();
+	memset(forward, 0xff, size_t(min(size, capacity)) * sizeof(uint32_t));
+	// States of this pool in the order of their copy
+	vector<uint32_t> copied(1, root - nodes);
+	forward[root - nodes] = target->alloc(1);
+
+	for (size_t k = 0; k < copied.size(); k++) {
+		State &old = nodes[copied[k]];
+		uint32_t copy = forward[copied[k]];
+		new (target->nodes + copy) State(old);
+		target->value[copy] = value[copied[k]];
+		target->visitCount[copy] = visitCount[copied[k]];
+		for (uint32_t i = 0; i < old.childrenCount; i++) {
+			uint32_t child = children[old.firstChild + i];
+			if (forward[child] == NO_STATE) {
+				forward[child] = target->alloc(1);
+				copied.push_back(child);
+			}
+		}
+	}
+
+	uint32_t entryCount = 0;
+	for (size_t k = 0; k < copied.size(); k++) {
+		State &old = nodes[copied[k]];
+		State &copy = target->nodes[forward[copied[k]]];
+		target->insert(&copy);
+		if (old.actionCount == 0)
+			continue;
+		copy.firstChild = target->allocChildren(old.actionCount);
+		target->clearRave(copy.firstChild, old.actionCount);
+		memcpy(target->childAction + copy.firstChild, childAction + old.firstChild, old.actionCount);
+		if (prior != NULL)
+			memcpy(target->prior + copy.firstChild, prior + old.firstChild, old.actionCount * sizeof(float));
+		for (uint32_t i = 0; i < old.childrenCount; i++) {
+			target->children[copy.firstChild + i] = forward[children[old.firstChild + i]];
+			if (raveValue != NULL) {
+				target->raveValue[copy.firstChild + i] = raveValue[old.firstChild + i];
+				target->raveCount[copy.firstChild + i] = raveCount[old.firstChild + i];
+			}
+		}
+		entryCount += old.childrenCount;
+	}
+	// every copy but the root is reached by one entry at least, the other entries are transpositions
+	target->transpositionCount = entryCount - (copied.size() - 1);
+
+	clear();
+	return target->nodes + forward[root - nodes];
+}
+
+/*
+	The visits of a State bound those of its children, so keeping the children of the
+	States visited at least threshold times keeps about the blocks counted from it.
+	Blocks are counted by power of 2 of the visits of their parent.
+*/
+int StatePool::recycleThreshold(uint32_t keep, uint32_t keepChildren) {
+	uint32_t states[32] = {0};
+	uint32_t entries[32] = {0};
+	for (uint32_t i = 0; i < min(size, capacity); i++) {
+		if (nodes[i].actionCount > 0) {
+			int bucket = 31 - __builtin_clz(max(1, visitCount[i]));
+			states[bucket] += nodes[i].childrenCount;
+			entries[bucket] += nodes[i].actionCount;
+		}
+	}
+	uint32_t kept = 0;
+	uint32_t keptChildren = 0;
+	int bucket = 31;
+	while (bucket > 0 && kept + states[bucket] <= keep && keptChildren + entries[bucket] <= keepChildren) {
+		kept += states[bucket];
+		keptChildren += entries[bucket--];
+	}
+	return 1 << (bucket + 1);
+}
+
+/*
+	forward first marks the kept States, then maps them to their new index in the same
+	order, so sliding them down one by one never overwrites a State not moved yet. The
+	kept children blocks slide down the same way, in the order of their first entry.
+	A block is kept or dropped as a whole, and the root always keeps its children.
+	A State losing its children becomes a leaf again, with its statistics.
+*/
+State *StatePool::recycle(State *root, int threshold) {
+	// a failed alloc() leaves size past the capacity
+	size = min(size, capacity);
+	childrenSize = min(childrenSize, childrenCapacity);
+	uint32_t oldRoot = root - nodes;
+	memset(forward, 0xff, size_t(size) * sizeof(uint32_t));
+	// (first entry, State) of the kept children blocks
+	vector<pair<uint32_t, uint32_t> > blocks;
+	vector<uint32_t> pending(1, oldRoot);
+	forward[oldRoot] = 0;
+
+	while (!pending.empty()) {
+		uint32_t index = pending.back();
+		State &state = nodes[index];
+		pending.pop_back();
+		if (state.actionCount == 0)
+			continue;
+		if (index != oldRoot && visitCount[index] < threshold) {
+			state.firstChild = NO_STATE;
+			state.actionCount = 0;
+			state.childrenCount = 0;
+			state.expandState = LEAF;
+			continue;
+		}
+		blocks.push_back(make_pair(state.firstChild, index));
+		for (uint32_t i = 0; i < state.childrenCount; i++) {
+			uint32_t child = children[state.firstChild + i];
+			if (forward[child] == NO_STATE) {
+				forward[child] = 0;
+				pending.push_back(child);
+			}
+		}
+	}
+
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		if (forward[i] != NO_STATE)
+			forward[i] = kept++;
+	}
+
+	sort(blocks.begin(), blocks.end());
+	uint32_t keptChildren = 0;
+	uint32_t entryCount = 0;
+	for (size_t k = 0; k < blocks.size(); k++) {
+		State &state = nodes[blocks[k].second];
+		// the blocks only slide down
+		memmove(childAction + keptChildren, childAction + state.firstChild, state.actionCount);
+		if (prior != NULL)
+			memmove(prior + keptChildren, prior + state.firstChild, state.actionCount * sizeof(float));
+		for (uint32_t i = 0; i < state.childrenCount; i++) {
+			children[keptChildren + i] = forward[children[state.firstChild + i]];
+			if (raveValue != NULL) {
+				raveValue[keptChildren + i] = raveValue[state.firstChild + i];
+				raveCount[keptChildren + i] = raveCount[state.firstChild + i];
+			}
+		}
+		// the untried entries have no statistics, and no entry of a later block is moved yet
+		clearRave(keptChildren + state.childrenCount, state.actionCount - state.childrenCount);
+		state.firstChild = keptChildren;
+		keptChildren += state.actionCount;
+		entryCount += state.childrenCount;
+	}
+
+	memset(table, 0xff, tableSize * sizeof(uint32_t));
+	for (uint32_t i = 0; i < size; i++) {
+		uint32_t j = forward[i];
+		if (j == NO_STATE)
+			continue;
+		if (j != i) {
+			nodes[j] = nodes[i];
+			value[j] = value[i];
+			visitCount[j] = visitCount[i];
+		}
+		insert(nodes + j);
+	}
+	size = kept;
+	childrenSize = keptChildren;
+	transpositionCount = entryCount - (kept - 1);
+	return nodes + forward[oldRoot];
+}
+
+/*
+	frame is the symmetry mapping the tree onto the real board, action a cell of the real
+	board. A symmetric State only keeps the lowest action of each class: the tree follows
+	the kept one, and frame changes so that it maps it onto action.
+*/
+State *opponentPlay(State *state, Mask128 action, int &frame) {
+	int treeAction = symmetry.cell[symmetry.inverse[frame]][actionIndex(action)];
+	for (size_t i = 0; i < state->childrenCount; i++) {
+		if (actionMask(treeAction) == state->childAction(i))
+			return state->child(i);
+	}
+	Game game = state->game();
+	int symmetries = state->expanded() && state->actionCount < game.validActionCount ? game.symmetries() : 1;
+	for (int s = 1; s < 8; s++) {
+		if (!((symmetries >> s) & 1))
+			continue;
+		for (size_t i = 0; i < state->childrenCount; i++) {
+			if (actionMask(symmetry.cell[s][treeAction]) == state->childAction(i)) {
+				frame = symmetry.compose[frame][symmetry.inverse[s]];
+				return state->child(i);
+			}
+		}
+	}
+	// the action is not in the tree: never tried, or state never expanded because the pool was full, or only its winning child was
+	game.play(actionMask(treeAction));
+	// another path may have reached the position
+	State *known = pool->find(game);
+	if (known != NULL)
+		return known;
+	cerr << "Action " << actionIndex(action) << " not in tree: new root" << endl;
+	// the rest of the tree is released by the next promotion
+	if (!pool->full(1))
+		return pool->create(game);
+	return pool->reroot(game);
+}
+
+void readInput(Mask128 &oppAction, int *validAction) {
+	int opp_row; int opp_col;
+	cin >> opp_row >> opp_col; cin.ignore();
+	if (opp_row == -1)
+		oppAction = 0;
+	else
+		oppAction = int128(1) << posToIndex[opp_row][opp_col];
+	// cerr << mtos(oppAction, 81) << endl;
+
+	int valid_action_count;
+	cin >> valid_action_count; cin.ignore();
+	for (int i = 0; i < valid_action_count; i++) {
+	    int row; int col;
+	    cin >> row >> col; cin.ignore();
+	    validAction[i] = posToIndex[row][col];
+	}
+}
+
+void generateInput(State *current, Mask128 &oppAction, int *validAction) {
+	oppAction = current->game().randAction(rng);
+}
+
+// rollouts run for each selected leaf, and if it decreases with the rollouts the leaf already received
+int leafBatch = 1;
+bool adaptiveLeafBatch = false;
+
+/*
+	Leaf parallelism: helper threads wait for a batch of rollouts from one leaf, each
+	runs its share with its own random stream and adds up its results, so the cost of
+	the selection and of the backpropagation is paid once for the whole batch.
+*/
+// microseconds a helper waits for the next batch before parking: during a search the batches follow each other closely
+#define HELPER_SPIN_TIME 200
+
+struct RolloutHelpers {
+	vector<thread> threads;
+	atomic<unsigned> generation;
+	atomic<int> pending;
+	atomic<bool> stop;
+	atomic<int> parkedCount;
+	mutex parking;
+	condition_variable wakeUp;
+	State *leaf;
+	int batchSize;
+	float batchValue;
+
+	RolloutHelpers(int helperCount, uint64_t seed, int firstStream) : generation(0), pending(0), stop(false), parkedCount(0) {
+		for (int i = 0; i < helperCount; i++)
+			threads.push_back(thread(&RolloutHelpers::loop, this, i + 1, seed, firstStream + i));
+	}
+
+	~RolloutHelpers() {
+		stop = true;
+		wakeAll();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	void wakeAll() {
+		lock_guard<mutex> lock(parking);
+		wakeUp.notify_all();
+	}
+
+	// rollouts of a thread in the batch, the calling thread being 0
+	int share(int helper) {
+		int threadCount = threads.size() + 1;
+		return batchSize * (helper + 1) / threadCount - batchSize * helper / threadCount;
+	}
+
+	void loop(int helper, uint64_t seed, int stream) {
+		rng.setSeed(seed, stream);
+		unsigned seen = 0;
+		while (true) {
+			chrono::steady_clock::time_point parkTime = chrono::steady_clock::now() + chrono::microseconds(HELPER_SPIN_TIME);
+			while (generation.load(memory_order_acquire) == seen && !stop.load(memory_order_relaxed) && chrono::steady_clock::now() < parkTime)
+				this_thread::yield();
+			// between the searches, and during the opponent's turn, sleep until the next batch
+			if (generation.load(memory_order_acquire) == seen) {
+				unique_lock<mutex> lock(parking);
+				parkedCount++;
+				wakeUp.wait(lock, [&]() { return generation.load() != seen || stop.load(); });
+				parkedCount--;
+			}
+			if (generation.load(memory_order_acquire) == seen)
+				return;
+			seen++;
+			atomicAdd(batchValue, leaf->rollout(rng, share(helper)));
+			pending.fetch_sub(1, memory_order_release);
+		}
+	}
+
+	// sum of the results of __batchSize rollouts from __leaf
+	float run(State *__leaf, int __batchSize, Xoroshiro128 &rng) {
+		leaf = __leaf;
+		batchSize = __batchSize;
+		batchValue = 0;
+		pending.store(threads.size(), memory_order_relaxed);
+		// sequentially consistent with parkedCount: a helper about to park sees the new generation, or is woken
+		generation.fetch_add(1);
+		if (parkedCount.load() > 0)
+			wakeAll();
+
+		float value = leaf->rollout(rng, share(0));
+		while (pending.load(memory_order_acquire) > 0)
+			this_thread::yield();
+		return value + batchValue;
+	}
+};
+
+RolloutHelpers *rolloutHelpers = NULL;
+
+// an adaptive batch shrinks with the visits of the leaf
+int leafBatchSize(State *leaf) {
+	if (leafBatch == 1)
+		return 1;
+	if (!adaptiveLeafBatch)
+		return leafBatch;
+	// visitCount() already includes the visit of this iteration
+	return max(1, leafBatch / leaf->visitCount());
+}
+
+// empty cells from which a position is solved exactly rather than rolled out, 0 to never solve
+int solverCells = 20;
+
+// the root is solved from more empty cells than a leaf: its solve is bounded by time rather than by nodes
+#define ROOT_SOLVER_EXTRA_CELLS 12
+
+// nodes a leaf solve may visit before giving up: the rollout is cheaper than a long solve
+#define LEAF_SOLVER_NODES 4000
+
+// buckets of the transposition table of a solver, a power of 2
+#define SOLVER_TABLE_SIZE (1 << 16)
+
+// an aborted solve proves nothing
+#define UNSOLVED 2
+
+/*
+	Exact alpha-beta (negamax) search of an endgame, scored for the player to move:
+	1 won, 0 drawn, -1 lost. An action completing a line of the big board ends the search
+	of a node at once; the others are tried from the best action stored in the table,
+	then those winning a small board, and last those letting the opponent play anywhere.
+	A solve visiting more nodes than its budget, or past its deadline, is aborted: the
+	bounds its completed subtrees stored stay valid for the next solves.
+*/
+struct EndgameSolver {
+	enum Bound : uint8_t { EXACT, LOWER, UPPER };
+
+	struct Entry {
+		uint64_t hash;
+		int8_t score;
+		uint8_t bound;
+		uint8_t bestAction; // 127 if none
+	};
+
+	Entry *table;
+	long nodeCount;
+	long nodeLimit;
+	Deadline *deadline;
+	bool aborted;
+	// since the last log
+	int solveCount;
+	int solvedCount;
+	long totalNodeCount;
+	double totalTime;
+
+	EndgameSolver() : table(static_cast<Entry *>(calloc(SOLVER_TABLE_SIZE, sizeof(Entry)))), solveCount(0), solvedCount(0), totalNodeCount(0), totalTime(0) {}
+
+	~EndgameSolver() { free(table); }
+
+	static bool solvable(Game &game, int extraCells = 0) { return solverCells > 0 && game.emptyCellCount() <= solverCells + extraCells; }
+
+	// score of game for the player to move, UNSOLVED if the budget ran out first
+	int solve(Game game, long __nodeLimit, Deadline *__deadline = NULL) {
+		Timer start;
+		nodeCount = 0;
+		nodeLimit = __nodeLimit;
+		deadline = __deadline;
+		aborted = false;
+		int score = negamax(game, -1, 1);
+		solveCount++;
+		solvedCount += !aborted;
+		totalNodeCount += nodeCount;
+		totalTime += start.diff();
+		return aborted ? UNSOLVED : score;
+	}
+
+	// action of the solved game reaching its score, stored in the table by solve()
+	Mask128 bestAction(Game &game) {
+		Mask128 winning = game.winningActions();
+		if (winning)
+			return winning & -winning;
+		Entry &entry = table[game.hash & (SOLVER_TABLE_SIZE - 1)];
+		return entry.hash == game.hash && entry.bestAction != 127 ? actionMask(entry.bestAction) : 0;
+	}
+
+	int negamax(Game &game, int alpha, int beta) {
+		if (++nodeCount > nodeLimit || (deadline != NULL && deadline->expired())) {
+			aborted = true;
+			return 0;
+		}
+		if (game.final()) {
+			float result = game.myTurn ? game.result() : 1 - game.result();
+			return result == 1 ? 1 : result == 0 ? -1 : 0;
+		}
+		if (game.winningActions())
+			return 1;
+
+		Entry &entry = table[game.hash & (SOLVER_TABLE_SIZE - 1)];
+		int first = 127;
+		if (entry.hash == game.hash) {
+			if (entry.bound == EXACT)
+				return entry.score;
+			if (entry.bound == LOWER)
+				alpha = max(alpha, int(entry.score));
+			else
+				beta = min(beta, int(entry.score));
+			if (alpha >= beta)
+				return entry.score;
+			first = entry.bestAction;
+		}
+
+		int actions[81];
+		int count = orderActions(game, first, actions);
+		int initialAlpha = alpha;
+		int best = -2;
+		int bestAction = 127;
+		for (int i = 0; i < count && alpha < beta; i++) {
+			Game child = game;
+			child.play(actionMask(actions[i]));
+			int score = -negamax(child, -beta, -alpha);
+			if (aborted)
+				return 0;
+			if (score > best) {
+				best = score;
+				bestAction = actions[i];
+			}
+			alpha = max(alpha, score);
+		}
+
+		entry.hash = game.hash;
+		entry.score = best;
+		entry.bound = best <= initialAlpha ? UPPER : best >= beta ? LOWER : EXACT;
+		entry.bestAction = bestAction;
+		return best;
+	}
+
+	// valid actions of game in search order, first being the action stored in the table
+	int orderActions(Game &game, int first, int actions[81]) {
+		Mask128 winsBoard = game.smallBoardWinningActions();
+		Mask128 freeChoice = game.freeChoiceActions();
+		Mask128 firstAction = first != 127 ? actionMask(first) & game.validAction : 0;
+		Mask128 rest = game.validAction & ~firstAction;
+		Mask128 groups[4] = { firstAction, rest & winsBoard, rest & ~winsBoard & ~freeChoice, rest & ~winsBoard & freeChoice };
+		int count = 0;
+		for (int g = 0; g < 4; g++) {
+			for (Mask128 mask = groups[g]; mask; mask &= mask - 1)
+				actions[count++] = actionIndex(mask);
+		}
+		return count;
+	}
+
+	void log() {
+		if (solveCount == 0)
+			return;
+		cerr << "solver: " << solvedCount << " solved of " << solveCount << ", " << totalNodeCount << " nodes, " << totalNodeCount / max(totalTime, 0.001) / 1000 << " Mnodes/s" << endl;
+		solveCount = 0;
+		solvedCount = 0;
+		totalNodeCount = 0;
+		totalTime = 0;
+	}
+};
+
+// solver of the thread, bound with its pool
+thread_local EndgameSolver *solver = NULL;
+
+// one selection, expansion, rollout and backpropagation from initialState
+void mctsIteration(State *initialState, Xoroshiro128 &rng) {
+	// a State may have several parents: the value goes back along the selected path
+	State *path[82];
+	int depth = 0;
+	State *current = initialState;
+
+	current->addVirtualLoss();
+	path[depth++] = current;
+	// a proven State is not searched anymore: its value is known
+	while (current->getProof() == UNPROVEN && current->expanded()) {
+		// no child yet while another thread builds the first one
+		State *child = current->selectChild();
+		if (child == NULL)
+			break;
+		current = child;
+		current->addVirtualLoss();
+		path[depth++] = current;
+	}
+
+	// the visit of this iteration is already counted
+	if (current->getProof() == UNPROVEN && current->visitCount() > 1 && current->expand()) {
+		State *child = current->selectChild();
+		if (child != NULL) {
+			current = child;
+			current->addVirtualLoss();
+			path[depth++] = current;
+		}
+	}
+
+	int batchSize = 1;
+	float value;
+	// the end of the simulation once rolled out, whose cells RAVE reads
+	Game game = current->game();
+	if (current->getProof() != UNPROVEN)
+		value = current->provenResult();
+	else {
+		// a final position is proven rather than rolled out
+		int score = UNSOLVED;
+		if (game.final()) {
+			current->prove(game);
+			value = game.result();
+		}
+		// an endgame is solved on the first visit of its leaf only: a failed solve is not retried
+		// the root is not a leaf to solve, it is proven from its children
+		else if (solver != NULL && current != initialState && current->visitCount() == 1 && EndgameSolver::solvable(game) && (score = solver->solve(game, LEAF_SOLVER_NODES)) != UNSOLVED) {
+			// the score is for the player to move, the proof for the one who moved into the State
+			current->prove(score > 0 ? PROVEN_LOSS : score < 0 ? PROVEN_WIN : PROVEN_DRAW);
+			value = current->provenResult();
+		}
+		else {
+			batchSize = leafBatchSize(current);
+			if (batchSize == 1) {
+				game = State::playout(game, rng);
+				value = game.result();
+			}
+			else
+				value = rolloutHelpers->run(current, batchSize, rng);
+		}
+	}
+
+	for (int i = depth - 1; i >= 0; i--)
+		path[i]->backpropagate(value, batchSize);
+
+	// a batch of rollouts keeps the cells of the leaf, with its average result
+	if (raveEquivalence > 0) {
+		for (int i = depth - 2; i >= 0; i--)
+			path[i]->updateRave(game.myBoard, game.oppBoard, value / batchSize);
+	}
+
+	// a proven leaf may prove its parents in turn
+	if (current->getProof() != UNPROVEN) {
+		int i = depth - 2;
+		while (i >= 0 && path[i]->proveFromChildren())
+			i--;
+	}
+}
+
+/*
+	Memory budget: when the pool cannot take one more expansion, a tree searched by a
+	single thread releases its least visited subtrees, down to about half the pool.
+	A shared tree, or a tree releasing too little, only stops growing.
+*/
+struct Recycler {
+	bool enabled;
+	int count;
+	uint32_t released;
+
+	Recycler() : enabled(!sharedTree), count(0), released(0) {}
+
+	// root moves with the compaction
+	void check(State *&root) {
+		if (!enabled || (!pool->full(1) && !pool->childrenFull(81)))
+			return;
+		uint32_t size = min(pool->size, pool->capacity);
+		root = pool->recycle(root, pool->recycleThreshold(pool->capacity / 2, pool->childrenCapacity / 2));
+		count++;
+		released += size - pool->size;
+		if (pool->full(pool->capacity / 8) || pool->childrenFull(pool->childrenCapacity / 8))
+			enabled = false;
+	}
+
+	void log() {
+		cerr << "nb of recycle = " << count << ", released = " << released << endl;
+	}
+};
+
+// initialState moves when the pool is recycled; settled: set when the search stops before the deadline
+State *mcts(State *&initialState, Deadline deadline, bool *settled = NULL) {
+    int nbOfSimule = 0;
+	Recycler recycler;
+	int initialVisitCount = initialState->visitCount();
+	bool stopped = false;
+
+	while (!deadline.expired()) {
+		// a proven root is settled in every mode: more iterations would only revisit its proof
+		if (initialState->getProof() != UNPROVEN) {
+			stopped = true;
+			break;
+		}
+		// the visits to come are estimated from those of the root so far, all threads included,
+		// once the search ran long enough for the estimate to hold
+		if (deadline.read && deadline.earlyStop && deadline.leftTime < 15 * deadline.elapsedTime) {
+			float remainingVisits = (initialState->visitCount() - initialVisitCount) * deadline.leftTime / deadline.elapsedTime;
+			if (initialState->settled(remainingVisits)) {
+				cerr << "settled with " << deadline.leftTime << " ms left" << endl;
+				stopped = true;
+				break;
+			}
+		}
+		recycler.check(initialState);
+		mctsIteration(initialState, rng);
+
+        nbOfSimule++;
+	}
+    cerr << "nb of simule = " << nbOfSimule << ", tree size = " << pool->size << ", children entries = " << pool->childrenSize << ", transpositions = " << pool->transpositionCount << endl;
+	if (recycler.count > 0)
+		recycler.log();
+	if (solver != NULL)
+		solver->log();
+	initialState->logProof();
+	if (settled != NULL)
+		*settled = stopped;
+	return initialState->maxAverageValueChild();
+}
+
+State *mcts(State *&initialState, int maxIter) {
+    int nbOfSimule = 0;
+	Recycler recycler;
+
+	while (nbOfSimule < maxIter && initialState->getProof() == UNPROVEN) {
+
+		recycler.check(initialState);
+		mctsIteration(initialState, rng);
+
+        nbOfSimule++;
+	}
+    cerr << "nb of simule = " << nbOfSimule << ", tree size = " << pool->size << ", children entries = " << pool->childrenSize << ", transpositions = " << pool->transpositionCount << endl;
+	if (recycler.count > 0)
+		recycler.log();
+	if (solver != NULL)
+		solver->log();
+	initialState->logProof();
+	return initialState->maxAverageValueChild();
+}
+
+/*
+	Root parallelism: every worker grows its own tree, in its own pool and with its
+	own random stream, from the current position. At the deadline the statistics of
+	the root children are summed over the workers and the move is chosen from them.
+
+	Tree parallelism (sharedTree): every worker searches the tree of the first one,
+	only the random streams differ. Selection adds a virtual loss, the statistics are
+	updated atomically and a leaf is expanded by a single thread.
+*/
+struct Worker {
+	StatePool *workerPool;
+	StatePool *sparePool;
+	EndgameSolver *workerSolver;
+	Xoroshiro128 workerRng;
+	State *current;
+	// symmetry mapping the tree onto the real board, see opponentPlay()
+	int frame;
+	bool ownsTree;
+	int rootVisitCount;
+	// the last search stopped before its deadline, see mcts()
+	bool settled;
+
+	void init(const Game &game, uint64_t seed, int stream, Worker *shared = NULL) {
+		workerRng.setSeed(seed, stream);
+		// every thread solves its own leaves
+		workerSolver = new EndgameSolver();
+		frame = 0;
+		settled = false;
+		ownsTree = shared == NULL;
+		if (!ownsTree) {
+			share(shared);
+			return;
+		}
+		rootVisitCount = 0;
+		workerPool = new StatePool(poolCapacity);
+		sparePool = new StatePool(poolCapacity);
+		bind();
+		current = pool->create(game);
+	}
+
+	// make the pool and the solver of this worker the ones of the calling thread
+	void bind() {
+		pool = workerPool;
+		solver = workerSolver;
+	}
+
+	// search the tree of owner from its root
+	void share(Worker *owner) {
+		workerPool = owner->workerPool;
+		current = owner->current;
+		frame = owner->frame;
+	}
+
+	// cell of the real board of an action of the tree
+	Mask128 toReal(Mask128 action) { return actionMask(symmetry.cell[frame][actionIndex(action)]); }
+
+	void search(Deadline deadline) {
+		bind();
+		rng = workerRng;
+		mcts(current, deadline, &settled);
+		workerRng = rng;
+		rootVisitCount = current->visitCount();
+	}
+
+	// follow action, a cell of the real board, in the tree, releasing the pool when it has not enough room left for a turn
+	void play(Mask128 action) {
+		bind();
+		current = opponentPlay(current, action, frame);
+		if (pool->full(pool->capacity / 4) || pool->childrenFull(pool->childrenCapacity / 4))
+			current = pool->reroot(current->game());
+	}
+
+	// make current the root of a fresh pool, releasing every discarded sibling subtree
+	void promote() {
+		bind();
+		// most of the tree is kept: copying it would cost more than it releases
+		if (current->visitCount() * 2 > rootVisitCount)
+			return;
+		current = workerPool->promote(current, sparePool);
+		swap(workerPool, sparePool);
+		bind();
+	}
+};
+
+// follow action in every tree, the workers sharing a tree take the new root of its owner
+void playAll(Worker *workers, int workerCount, Mask128 action) {
+	for (int i = 0; i < workerCount; i++) {
+		if (workers[i].ownsTree)
+			workers[i].play(action);
+		else
+			workers[i].share(&workers[0]);
+	}
+}
+
+// promote the root of every tree, each in its own thread
+void promoteAll(Worker *workers, int workerCount) {
+	Timer start;
+	uint32_t released = 0;
+	uint32_t kept = 0;
+	vector<thread> threads;
+	for (int i = 0; i < workerCount; i++) {
+		if (!workers[i].ownsTree)
+			continue;
+		released += workers[i].workerPool->size;
+		threads.push_back(thread(&Worker::promote, &workers[i]));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	for (int i = 0; i < workerCount; i++) {
+		if (workers[i].ownsTree)
+			kept += workers[i].workerPool->size;
+		else
+			workers[i].share(&workers[0]);
+	}
+	cerr << "promote: kept " << kept << " of " << released << " states in " << start.diff() << " ms" << endl;
+}
+
+// true when every search stopped before the deadline, its root settled or proven
+bool parallelSearch(Worker *workers, int workerCount, Deadline deadline) {
+	// before any thread descends a shared tree
+	for (int i = 0; i < workerCount; i++) {
+		if (!workers[i].ownsTree)
+			continue;
+		workers[i].bind();
+		workers[i].current->reopen();
+	}
+	vector<thread> threads;
+	for (int i = 1; i < workerCount; i++)
+		threads.push_back(thread(&Worker::search, &workers[i], deadline));
+	// the calling thread runs the first worker
+	workers[0].search(deadline);
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	bool settled = true;
+	for (int i = 0; i < workerCount; i++)
+		settled = settled && workers[i].settled;
+	return settled;
+}
+
+// action of the root child with the best average value once the statistics of every worker are merged, 0 if none,
+// and that average in bestAverage; the trees may be symmetric images of the real board: the statistics are merged by real cell
+Mask128 mergedBestAction(Worker *workers, int workerCount, float *bestAverage = NULL) {
+	float value[81] = {0};
+	int visitCount[81] = {0};
+	for (int w = 0; w < workerCount; w++) {
+		if (!workers[w].ownsTree)
+			continue;
+		workers[w].bind();
+		State *root = workers[w].current;
+		for (size_t i = 0; i < root->childrenCount; i++) {
+			int action = actionIndex(workers[w].toReal(root->childAction(i)));
+			value[action] += root->child(i)->value();
+			visitCount[action] += root->child(i)->visitCount();
+		}
+	}
+
+	// every child may be proven lost, valued -PROVEN_VALUE
+	Mask128 bestAction = 0;
+	float maxAverageValue = -FLT_MAX;
+	for (int action = 0; action < 81; action++) {
+		if (visitCount[action] == 0)
+			continue;
+		float averageValue = value[action] / visitCount[action];
+		if (averageValue > maxAverageValue) {
+			maxAverageValue = averageValue;
+			bestAction = actionMask(action);
+		}
+	}
+	if (bestAverage != NULL)
+		*bestAverage = maxAverageValue;
+	return bestAction;
+}
+
+// winning action of the root of worker if its endgame is solved before deadline, 0 if it is not solved or not won
+Mask128 solvedWinningAction(Worker &worker, Deadline deadline) {
+	Game game = worker.current->game();
+	if (!EndgameSolver::solvable(game, ROOT_SOLVER_EXTRA_CELLS))
+		return 0;
+	worker.bind();
+	int score = solver->solve(game, LONG_MAX, &deadline);
+	solver->log();
+	if (score == UNSOLVED)
+		return 0;
+	cerr << "endgame solved: " << (score > 0 ? "win" : score < 0 ? "loss" : "draw") << endl;
+	return score > 0 ? worker.toReal(solver->bestAction(game)) : 0;
+}
+
+/*
+	Time of each move. Without a game clock, the first move and the next ones have a
+	hard limit each, 990 and 90 ms unless set, and unspent time is lost: every move
+	uses its whole limit, even with a single legal action as it grows the tree of the
+	next move. With a game clock, the limits only apply if they are set.
+	With a game clock, a move gets its share of the remaining clock over the moves
+	expected to remain, weighted by the phase: less in the opening, more when many
+	actions are legal. The time saved on the regular share goes to a bank, spent on
+	the critical middlegame moves. A move with a single legal action, or one of the
+	opening book, is answered at once and its whole share goes to the bank.
+	The search of a move stops as soon as its result is settled, which feeds the bank.
+*/
+struct TimeManager {
+	float firstMoveTime;
+	float moveTime;
+	float gameTime;
+	float remaining;
+	float bank;
+	float share;
+	float lastBudget;
+	// the part of lastBudget taken from the share, the one an early stop saves
+	float shareBudget;
+	int earlyStopCount;
+	float savedTime;
+
+	// 0: no limit set
+	TimeManager() : firstMoveTime(0), moveTime(0), gameTime(0), remaining(0), bank(0), share(0), lastBudget(0), shareBudget(0), earlyStopCount(0), savedTime(0) {}
+
+	// the settled child rule: time left by a search is only worth saving in the bank of a game clock (a proven root always stops)
+	bool earlyStop() { return gameTime != 0; }
+
+	void setGameTime(float __gameTime) {
+		gameTime = __gameTime;
+		remaining = __gameTime;
+	}
+
+	// the middle game where the choice matters: the opponent let us play in any board, or in a busy one
+	static bool critical(const Game &game) {
+		return game.depth >= 12 && game.depth < 50 && game.validActionCount >= 6;
+	}
+
+	// time of this move in ms, 0 if it needs no search; known: the action comes from the opening book
+	float budget(const Game &game, bool first, bool known = false) {
+		lastBudget = computeBudget(game, first, known);
+		return lastBudget;
+	}
+
+	float computeBudget(const Game &game, bool first, bool known) {
+		share = 0;
+		shareBudget = 0;
+		float limit = first ? firstMoveTime : moveTime;
+		if (gameTime == 0)
+			return limit > 0 ? limit : first ? 990 : 90;
+
+		// a game lasts about 60 plies, half of them ours
+		int movesLeft = max(5, (60 - game.depth) / 2);
+		share = (remaining - bank) / movesLeft;
+		if (known || game.validActionCount == 1)
+			return 0;
+		float weight = game.depth < 12 ? 0.6 : game.validActionCount > 9 ? 1.5 : 1;
+		float budget = share * weight;
+		shareBudget = budget;
+		if (critical(game))
+			budget += bank / 2;
+		if (limit > 0)
+			budget = min(budget, limit);
+		// keep a margin of the clock for the moves left
+		return max(1.f, min(budget, remaining - 5 * movesLeft));
+	}
+
+	// settled: the search stopped before its deadline, see parallelSearch()
+	void spent(float used, bool settled = false) {
+		if (gameTime == 0)
+			return;
+		remaining -= used;
+		bank = max(0.f, min(bank + share - used, remaining / 2));
+		// the bank added to a critical move was saved by former moves
+		if (settled) {
+			earlyStopCount++;
+			savedTime += max(0.f, min(shareBudget, lastBudget) - used);
+		}
+	}
+
+	// the game may end on a move of the opponent: the totals of the game are logged every move
+	void log() {
+		if (gameTime == 0)
+			return;
+		cerr << "clock remaining " << remaining << " ms, bank " << bank << " ms" << endl;
+		cerr << "nb of early stop = " << earlyStopCount << ", saved " << savedTime << " ms of " << gameTime - remaining << " ms used" << endl;
+	}
+};
+
+// "UTB1" in the first bytes of a book file
+#define BOOK_MAGIC 0x31425455
+
+/*
+	Opening book: the best action found by a deep search of the positions of the first
+	plies, for the player to move. The file is a header and the entries sorted by the
+	hash of their position, mapped in memory as is and searched by dichotomy.
+	An entry covers the 8 images of its position by the symmetries: a position is
+	looked up through the hash of each of its images, and the action of the entry found
+	mapped back by the inverse symmetry.
+*/
+struct OpeningBook {
+	struct Header {
+		uint32_t magic;
+		uint32_t entryCount;
+	};
+
+	struct Entry {
+		uint64_t hash;
+		uint32_t action;
+		// average value of the action for the player to move
+		float value;
+	};
+
+	const Entry *entries;
+	uint32_t entryCount;
+	void *map;
+	size_t mapSize;
+
+	OpeningBook() : entries(NULL), entryCount(0), map(NULL), mapSize(0) {}
+
+	~OpeningBook() {
+		if (map != NULL)
+			munmap(map, mapSize);
+	}
+
+	// false if the file is not a book: the engine then plays without
+	bool open(const char *path) {
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+			mapSize = st.st_size;
+			map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED)
+				map = NULL;
+		}
+		close(fd);
+		if (map == NULL)
+			return false;
+		const Header *header = static_cast<const Header *>(map);
+		if (header->magic != BOOK_MAGIC || sizeof(Header) + size_t(header->entryCount) * sizeof(Entry) > mapSize) {
+			munmap(map, mapSize);
+			map = NULL;
+			return false;
+		}
+		entryCount = header->entryCount;
+		entries = reinterpret_cast<const Entry *>(header + 1);
+		return true;
+	}
+
+	const Entry *find(uint64_t hash) const {
+		const Entry *entry = lower_bound(entries, entries + entryCount, hash, [](const Entry &e, uint64_t h) { return e.hash < h; });
+		return entry != entries + entryCount && entry->hash == hash ? entry : NULL;
+	}
+
+	// valid action of the book for game, 0 if out of book
+	Mask128 action(Game &game) const {
+		for (int s = 0; s < 8 && entryCount > 0; s++) {
+			const Entry *entry = find(game.imageHash(s));
+			if (entry == NULL)
+				continue;
+			Mask128 action = actionMask(symmetry.cell[symmetry.inverse[s]][entry->action]);
+			// the hash may be shared by another position
+			if (action & game.validAction) {
+				cerr << "book: " << indexToPos[actionIndex(action)] << " value " << entry->value << endl;
+				return action;
+			}
+		}
+		return 0;
+	}
+
+	static bool write(const char *path, vector<Entry> entries) {
+		sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+		FILE *file = fopen(path, "wb");
+		if (file == NULL)
+			return false;
+		Header header = { BOOK_MAGIC, uint32_t(entries.size()) };
+		bool written = fwrite(&header, sizeof(Header), 1, file) == 1 && fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size();
+		return fclose(file) == 0 && written;
+	}
+};
+
+// former randAction(): walk the mask one bit at a time up to the randIndex-th valid action
+Mask128 walkRandAction(Game &g, Xoroshiro128 &rng) {
+	int randIndex = g.validActionCount == 1 ? 0 : rng.bounded(g.validActionCount);
+	Mask128 action = int128(1) << g.firstActionIndex(g.validAction);
+	while (randIndex > 0 || !(action & g.validAction)) {
+		randIndex -= action & g.validAction ? 1 : 0;
+		action <<= 1;
+	}
+	return action;
+}
+
+// rollouts per second from the empty board, with randAction(), with the former bit walk, with the heavy policy and with GameBatch
+void benchRollout(int rolloutCount) {
+	Game initialGame = Game(0, 0, 0, 0, 0, -1, 0);
+	float total = 0;
+
+	Timer start;
+	for (int i = 0; i < rolloutCount; i++) {
+		Game g = initialGame;
+		while (!g.final())
+			g.play(g.randAction(rng));
+		total += g.result();
+	}
+	double selectTime = start.diff();
+
+	for (int i = 0; i < rolloutCount; i++) {
+		Game g = initialGame;
+		while (!g.final())
+			g.play(walkRandAction(g, rng));
+		total += g.result();
+	}
+	double walkTime = start.diff();
+
+	cerr << "rollouts    = " << rolloutCount << " (total " << total << ")" << endl;
+	cerr << "select      = " << setw(8) << left << selectTime << " ms, " << rolloutCount / selectTime * 1000 << " rollouts/s" << endl;
+	cerr << "walk        = " << setw(8) << left << walkTime << " ms, " << rolloutCount / walkTime * 1000 << " rollouts/s" << endl;
+	cerr << "speedup     = " << walkTime / selectTime << endl;
+
+	for (int i = 0; i < rolloutCount; i++) {
+		Game g = initialGame;
+		while (!g.final())
+			g.play(g.playoutAction(rng));
+		total += g.result();
+	}
+	double heavyTime = start.diff();
+	cerr << "heavy       = " << setw(8) << left << heavyTime << " ms, " << rolloutCount / heavyTime * 1000 << " rollouts/s" << endl;
+
+#ifdef HAS_AVX2
+	float result[BATCH_LANES];
+	start.set();
+	for (int i = 0; i < rolloutCount; i += BATCH_LANES) {
+		GameBatch batch(initialGame);
+		while (!batch.allDone())
+			batch.step(rng);
+		batch.result(result);
+		for (int lane = 0; lane < BATCH_LANES; lane++)
+			total += result[lane];
+	}
+	double batchTime = start.diff();
+	cerr << "batch       = " << setw(8) << left << batchTime << " ms, " << rolloutCount / batchTime * 1000 << " rollouts/s" << endl;
+	cerr << "speedup     = " << selectTime / batchTime << " (over select)" << endl;
+#endif
+}
+
+/*
+	Self-checks of the fast paths against their plain counterparts, run by ./mcts test.
+	Each check prints its number of mismatches, and the exit code is their total.
+*/
+
+#ifdef HAS_AVX2
+
+// GameBatch against Game, ply by ply: the action a lane played is replayed on a Game of its own
+int checkGameBatch(int batchCount) {
+	int mismatchCount = 0;
+	long stepCount = 0;
+	for (int i = 0; i < batchCount; i++) {
+		Game start(0, 0, 0, 0, i & 1, -1, 0);
+		for (int prefix = rng.bounded(20); prefix > 0 && !start.final(); prefix--)
+			start.play(start.randAction(rng));
+		GameBatch batch(start);
+		Game lane[BATCH_LANES] = {start, start, start, start};
+		while (!batch.allDone()) {
+			Mask128 before[BATCH_LANES];
+			for (int l = 0; l < BATCH_LANES; l++)
+				before[l] = GameBatch::laneCells(batch.myBoard, l) | GameBatch::laneCells(batch.oppBoard, l);
+			batch.step(rng);
+			stepCount++;
+			for (int l = 0; l < BATCH_LANES; l++) {
+				Mask128 action = (GameBatch::laneCells(batch.myBoard, l) | GameBatch::laneCells(batch.oppBoard, l)) ^ before[l];
+				if (action != 0) {
+					mismatchCount += !(action & lane[l].validAction);
+					lane[l].play(action);
+				}
+				mismatchCount += batch.laneDone(l) != lane[l].final();
+				mismatchCount += !batch.laneDone(l) && GameBatch::laneCells(batch.validAction, l) != lane[l].validAction;
+			}
+		}
+		float result[BATCH_LANES];
+		batch.result(result);
+		for (int l = 0; l < BATCH_LANES; l++)
+			mismatchCount += result[l] != lane[l].result();
+	}
+	cerr << "GameBatch vs Game: " << stepCount << " steps, " << mismatchCount << " mismatches" << endl;
+	return mismatchCount;
+}
+
+// the AVX2 argmax against the scalar loop, on random children with unvisited ones and shared indices
+int checkUCB1Kernel(int setCount) {
+	int mismatchCount = 0;
+	const int statCount = 4096;
+	vector<float> value(statCount);
+	vector<int> visitCount(statCount);
+	uint32_t children[81];
+	for (int i = 0; i < setCount; i++) {
+		int count = 1 + rng.bounded(81);
+		int parentVisitCount = 1;
+		for (int c = 0; c < count; c++) {
+			children[c] = rng.bounded(10) == 0 ? rng.bounded(1024) : 1024 + c;
+			visitCount[children[c]] = rng.bounded(4) == 0 ? 0 : 1 + rng.bounded(i & 1 ? 50 : 5000);
+			value[children[c]] = visitCount[children[c]] * (rng.bounded(1001) / 1000.f);
+			parentVisitCount += visitCount[children[c]];
+		}
+		float exploration = 4 * visitLog(parentVisitCount);
+		int best = 0;
+		float maxUCB1 = -1;
+		for (int c = 0; c < count; c++) {
+			float UCB1 = State::UCB1(value[children[c]], visitCount[children[c]], exploration);
+			if (UCB1 > maxUCB1) {
+				maxUCB1 = UCB1;
+				best = c;
+			}
+		}
+		mismatchCount += maxUCB1Index(value.data(), visitCount.data(), children, count, exploration) != best;
+	}
+	cerr << "UCB1 kernel vs scalar: " << setCount << " sets, " << mismatchCount << " mismatches" << endl;
+	return mismatchCount;
+}
+
+#endif // end HAS_AVX2
+
+// Position::game() rebuilds every field of the Game it packs
+int checkPosition(int gameCount) {
+	int mismatchCount = 0;
+	long positionCount = 0;
+	for (int i = 0; i < gameCount; i++) {
+		Game game(0, 0, 0, 0, i & 1, -1, 0);
+		while (true) {
+			Game unpacked = Position(game).game();
+			Game hashed = game;
+			hashed.computeHash();
+			positionCount++;
+			mismatchCount += unpacked.myBoard != game.myBoard || unpacked.oppBoard != game.oppBoard
+				|| unpacked.myBigBoard != game.myBigBoard || unpacked.oppBigBoard != game.oppBigBoard
+				|| unpacked.nonFreeCell != game.nonFreeCell || unpacked.validAction != game.validAction
+				|| unpacked.validActionCount != game.validActionCount || unpacked.lastAction != game.lastAction
+				|| unpacked.myTurn != game.myTurn || unpacked.depth != game.depth || unpacked.hash != hashed.hash;
+			if (game.final())
+				break;
+			game.play(game.randAction(rng));
+		}
+	}
+	cerr << "Position round trip: " << positionCount << " positions, " << mismatchCount << " mismatches" << endl;
+	return mismatchCount;
+}
+
+// score of game for the player to move by plain minimax, as EndgameSolver::solve()
+int minimax(Game game) {
+	if (game.final()) {
+		float result = game.myTurn ? game.result() : 1 - game.result();
+		return result == 1 ? 1 : result == 0 ? -1 : 0;
+	}
+	int actionList[81];
+	int count = game.getActionList(actionList);
+	int best = -1;
+	for (int i = 0; i < count && best < 1; i++) {
+		Game child = game;
+		child.play(actionMask(actionList[i]));
+		best = max(best, -minimax(child));
+	}
+	return best;
+}
+
+// the solver against plain minimax on random endgames, and its best action of a won one
+int checkSolver(int endgameCount) {
+	int mismatchCount = 0;
+	int solvedCount = 0;
+	EndgameSolver solver;
+	for (int i = 0; i < endgameCount; i++) {
+		Game game(0, 0, 0, 0, i & 1, -1, 0);
+		int cells = 10 + rng.bounded(8);
+		while (!game.final() && game.emptyCellCount() > cells)
+			game.play(game.randAction(rng));
+		if (game.final())
+			continue;
+		solvedCount++;
+		int score = solver.solve(game, LONG_MAX);
+		mismatchCount += score != minimax(game);
+		if (score == 1) {
+			Mask128 action = solver.bestAction(game);
+			Game child = game;
+			child.play(action);
+			mismatchCount += !(action & game.validAction) || minimax(child) != -1;
+		}
+	}
+	cerr << "solver vs minimax: " << solvedCount << " endgames, " << mismatchCount << " mismatches" << endl;
+	return mismatchCount;
+}
+
+// a small tree following random games stays the image of the real board by its frame
+int checkSymmetryFrames(int gameCount) {
+	int mismatchCount = 0;
+	// opponentPlay() logs every action the small trees have not built
+	streambuf *log = cerr.rdbuf(NULL);
+	for (int i = 0; i < gameCount; i++) {
+		Game real(0, 0, 0, 0, 0, -1, 0);
+		pool->clear();
+		State *current = pool->create(real);
+		int frame = 0;
+		while (!real.final()) {
+			for (int k = 0; k < 100; k++)
+				mctsIteration(current, rng);
+			Mask128 action = real.randAction(rng);
+			real.play(action);
+			current = opponentPlay(current, action, frame);
+			Game tree = current->game();
+			if (Game::transform(frame, tree.myBoard) != real.myBoard || Game::transform(frame, tree.oppBoard) != real.oppBoard
+				|| Game::transform(frame, tree.validAction) != real.validAction) {
+				mismatchCount++;
+				break;
+			}
+		}
+	}
+	cerr.rdbuf(log);
+	cerr.clear();
+	cerr << "symmetry frames: " << gameCount << " games, " << mismatchCount << " mismatches" << endl;
+	return mismatchCount;
+}
+
+int selfTest() {
+	int mismatchCount = 0;
+#ifdef HAS_AVX2
+	mismatchCount += checkGameBatch(50000);
+	mismatchCount += checkUCB1Kernel(200000);
+#endif
+	mismatchCount += checkPosition(20000);
+	mismatchCount += checkSolver(300);
+	pool = new StatePool(1 << 16);
+	mismatchCount += checkSymmetryFrames(200);
+	delete pool;
+	pool = NULL;
+	return mismatchCount;
+}
+
+/*
+	Offline builder of the opening book. Every position within the first plies where the
+	engine is to move is searched for moveTime ms by the workers, and only the action found
+	is followed, while every distinct reply of the opponent is. A position whose image by a
+	symmetry is already in the book is skipped with its subtree. Both colors are covered:
+	the engine opens in the center, or answers any first action of the opponent.
+*/
+struct BookBuilder {
+	Worker *workers;
+	int workerCount;
+	int plies;
+	float moveTime;
+	vector<OpeningBook::Entry> entries;
+	unordered_set<uint64_t> known;
+
+	BookBuilder(Worker *__workers, int __workerCount, int __plies, float __moveTime) :
+		workers(__workers), workerCount(__workerCount), plies(__plies), moveTime(__moveTime) {}
+
+	bool inBook(Game &game) {
+		for (int s = 0; s < 8; s++) {
+			if (known.count(game.imageHash(s)))
+				return true;
+		}
+		return false;
+	}
+
+	// the engine is to move
+	void search(Game game) {
+		if (game.final() || game.depth >= plies || inBook(game))
+			return;
+		for (int i = 0; i < workerCount; i++) {
+			if (!workers[i].ownsTree)
+				continue;
+			workers[i].bind();
+			workers[i].current = pool->reroot(game);
+			workers[i].frame = 0;
+		}
+		for (int i = 0; i < workerCount; i++) {
+			if (!workers[i].ownsTree)
+				workers[i].share(&workers[0]);
+		}
+		parallelSearch(workers, workerCount, Deadline(Timer(), moveTime));
+		// the value of the action, merged over every tree like the action itself
+		float value = 0;
+		Mask128 action = mergedBestAction(workers, workerCount, &value);
+		OpeningBook::Entry entry = { game.hash, uint32_t(actionIndex(action)), value };
+		entries.push_back(entry);
+		known.insert(game.hash);
+		cerr << "book entry " << entries.size() << ": depth " << game.depth << ", " << indexToPos[actionIndex(action)] << " value " << value << endl;
+		game.play(action);
+		replies(game);
+	}
+
+	// the opponent is to move
+	void replies(Game game) {
+		if (game.final() || game.depth >= plies)
+			return;
+		for (Mask128 actions = game.distinctActions(); actions; actions &= actions - 1) {
+			Game next = game;
+			next.play(actions & -actions);
+			search(next);
+		}
+	}
+
+	void build() {
+		Game opening(0, 0, 0, 0, 1, -1, 0);
+		opening.play(opening.validAction);
+		replies(opening);
+		// the opponent may open anywhere
+		Game answer(0, 0, 0, 0, 0, -1, 0);
+		answer.validAction = fullOneMask;
+		answer.validActionCount = 81;
+		replies(answer);
+	}
+};
+
+// int main(int ac, char *av[]) {
+
+// 	rng.setSeed(time(NULL));
+
+// 	Game game = Game(0, 0, 0, 0, 0, -1, 0);
+
+// 	pool = new StatePool(POOL_SIZE);
+// 	State *state = pool->create(game);
+
+// 	Timer start;
+
+// 	State *child = mcts(state, Deadline(start, 1000));
+// 	cerr << "Simulation time = " << start.diff() << endl;
+// 	// child->game.log();
+
+// 	for (size_t i = 0; i < state->childrenCount; i++)
+// 		state->child(i)->log();
+
+// 	// while (!game.final()) {
+// 	// 	cerr << "- NEXT TURN -" << endl;
+// 	// 	game.play(game.randAction(rng));
+// 	// 	string str;
+// 	// 	getline(cin, str);
+// 	// }
+
+// 	pool->clear();
+// 	return 0;
+// }
+
+int main(int ac, char *av[]) {
+	// ./mcts [bench [rollouts]] [test] [--seed n] [--threads n] [--shared-tree] [--leaf-batch k] [--adaptive-batch] [--memory mb]
+	//        [--first-time ms] [--move-time ms] [--game-time ms] [--solver-cells n] [--light-playout] [--rave [k]] [--puct c] [--ucb1]
+	//        [--book file] [book-build file [plies [ms]]]
+	bool bench = false;
+	bool test = false;
+	int benchRolloutCount = 1000000;
+	const char *bookPath = NULL;
+	const char *bookBuildPath = NULL;
+	int bookPlies = 4;
+	float bookMoveTime = 1000;
+	uint64_t seed = time(NULL);
+	int threadCount = 1;
+	size_t memory = 0;
+	TimeManager timeManager;
+	for (int i = 1; i < ac; i++) {
+		string arg(av[i]);
+		if (arg == "bench") {
+			bench = true;
+			if (i + 1 < ac && isdigit(av[i + 1][0]))
+				benchRolloutCount = atoi(av[++i]);
+		}
+		else if (arg == "test")
+			test = true;
+		else if (arg == "--seed" && i + 1 < ac)
+			seed = strtoull(av[++i], NULL, 10);
+		else if (arg == "--threads" && i + 1 < ac)
+			threadCount = max(1, atoi(av[++i]));
+		else if (arg == "--shared-tree")
+			sharedTree = true;
+		else if (arg == "--leaf-batch" && i + 1 < ac)
+			leafBatch = max(1, atoi(av[++i]));
+		else if (arg == "--adaptive-batch")
+			adaptiveLeafBatch = true;
+		else if (arg == "--memory" && i + 1 < ac)
+			memory = size_t(max(1, atoi(av[++i]))) << 20;
+		else if (arg == "--first-time" && i + 1 < ac)
+			timeManager.firstMoveTime = atof(av[++i]);
+		else if (arg == "--move-time" && i + 1 < ac)
+			timeManager.moveTime = atof(av[++i]);
+		else if (arg == "--game-time" && i + 1 < ac)
+			timeManager.setGameTime(atof(av[++i]));
+		else if (arg == "--solver-cells" && i + 1 < ac)
+			solverCells = max(0, atoi(av[++i]));
+		else if (arg == "--light-playout")
+			heavyPlayout = false;
+		else if (arg == "--rave") {
+			raveEquivalence = 100;
+			if (i + 1 < ac && isdigit(av[i + 1][0]))
+				raveEquivalence = max(1, atoi(av[++i]));
+		}
+		else if (arg == "--puct" && i + 1 < ac)
+			puctExploration = max(0.01, atof(av[++i]));
+		else if (arg == "--ucb1")
+			puctExploration = 0;
+		else if (arg == "--book" && i + 1 < ac)
+			bookPath = av[++i];
+		else if (arg == "book-build" && i + 1 < ac) {
+			bookBuildPath = av[++i];
+			if (i + 1 < ac && isdigit(av[i + 1][0]))
+				bookPlies = atoi(av[++i]);
+			if (i + 1 < ac && isdigit(av[i + 1][0]))
+				bookMoveTime = atof(av[++i]);
+		}
+	}
+	rng.setSeed(seed);
+
+	// micro-benchmark of the rollout loop
+	if (bench) {
+		benchRollout(benchRolloutCount);
+		return 0;
+	}
+
+	// equivalence of the fast paths with the plain ones
+	if (test)
+		return selfTest() == 0 ? 0 : 1;
+
+	Mask128 oppAction;
+	int validAction[81];
+
+	// with batches of rollouts, a single tree is searched and the other threads help with the rollouts
+	int workerCount = threadCount;
+	if (leafBatch > 1) {
+		rolloutHelpers = new RolloutHelpers(threadCount - 1, seed, threadCount);
+		workerCount = 1;
+	}
+
+	/*
+		The budget covers the solver table of every worker and the two pools of every tree:
+		a State costs its node, its statistics, its forward entry, its children entries and
+		its buckets of the transposition table.
+	*/
+	if (memory > 0) {
+		int poolCount = 2 * (sharedTree ? 1 : workerCount);
+		size_t entryBytes = sizeof(uint32_t) + sizeof(uint8_t) + (raveEquivalence > 0 ? sizeof(float) + sizeof(int) : 0) + (puctExploration > 0 ? sizeof(float) : 0);
+		size_t stateBytes = sizeof(State) + sizeof(float) + sizeof(int) + sizeof(uint32_t) + CHILDREN_PER_STATE * entryBytes + TABLE_BUCKETS_PER_STATE * sizeof(uint32_t);
+		size_t solverBytes = size_t(workerCount) * SOLVER_TABLE_SIZE * sizeof(EndgameSolver::Entry);
+		size_t neededBytes = solverBytes + size_t(poolCount) * MIN_POOL_CAPACITY * stateBytes;
+		if (memory < neededBytes) {
+			cerr << "memory budget " << (memory >> 20) << " MB: at least " << (neededBytes >> 20) + 1 << " MB are needed" << endl;
+			return 1;
+		}
+		poolCapacity = min((memory - solverBytes) / poolCount / stateBytes, size_t(UINT32_MAX / CHILDREN_PER_STATE / 2));
+		cerr << "memory budget " << (memory >> 20) << " MB: " << poolCapacity << " states per pool" << endl;
+	}
+
+	Game initialGame = Game(0, 0, 0, 0, 0, -1, 0);
+	Worker *workers = new Worker[workerCount];
+	for (int i = 0; i < workerCount; i++)
+		workers[i].init(initialGame, seed, i, sharedTree && i > 0 ? &workers[0] : NULL);
+
+	// offline: search the opening and write the book
+	if (bookBuildPath != NULL) {
+		BookBuilder builder(workers, workerCount, bookPlies, bookMoveTime);
+		builder.build();
+		bool written = OpeningBook::write(bookBuildPath, builder.entries);
+		cerr << (written ? "book written: " : "cannot write the book: ") << builder.entries.size() << " entries" << endl;
+		delete rolloutHelpers;
+		return written ? 0 : 1;
+	}
+
+	// mapped as is: nothing to parse
+	OpeningBook book;
+	if (bookPath != NULL) {
+		if (book.open(bookPath))
+			cerr << "book: " << book.entryCount << " entries" << endl;
+		else
+			cerr << "cannot open the book " << bookPath << endl;
+	}
+
+	// the real board, the trees being its images by their frame
+	Game game = initialGame;
+	int first = true;
+    while (1) {
+
+		if (workers[0].current->game().final()) {
+			cerr << "result = " << workers[0].current->game().result() << endl;
+			delete rolloutHelpers;
+			return 0;
+		}
+
+		readInput(oppAction, validAction);
+		// generateInput(workers[0].current, oppAction, validAction);
+        Timer start;
+
+		if (first && oppAction == 0) {
+			game.myTurn = 1;
+			game.computeHash();
+		}
+		else
+			game.play(oppAction);
+
+		if (first) {
+			for (int i = 0; i < workerCount; i++) {
+				if (!workers[i].ownsTree) {
+					workers[i].share(&workers[0]);
+					continue;
+				}
+				// nothing is searched yet: the root is replaced
+				workers[i].bind();
+				workers[i].current = pool->reroot(game);
+			}
+		}
+		else {
+			playAll(workers, workerCount, oppAction);
+		}
+
+        workers[0].current->game().log();
+		// string str;
+		// getline(cin, str);
+
+        // my play
+		Mask128 bookAction = book.action(game);
+		float budget = timeManager.budget(game, first, bookAction != 0);
+		Mask128 action = 0;
+		bool settled = false;
+		if (budget > 0) {
+			// a won endgame is played from its solution, the solve may take half of the budget
+			if (bookAction == 0)
+				action = solvedWinningAction(workers[0], Deadline(start, budget / 2));
+			// without a game clock, a book move still grows the trees for the next moves
+			if (action == 0) {
+				settled = parallelSearch(workers, workerCount, Deadline(start, budget, timeManager.earlyStop()));
+				action = bookAction != 0 ? bookAction : mergedBestAction(workers, workerCount);
+			}
+		}
+		else if (bookAction != 0)
+			action = bookAction;
+		else {
+			// single valid action, its mask is the action: build its child so that the trees follow it
+			for (int i = 0; i < workerCount; i++) {
+				if (!workers[i].ownsTree)
+					continue;
+				workers[i].bind();
+				workers[i].current->expand();
+				workers[i].current->selectChild();
+			}
+			action = workers[0].toReal(workers[0].current->game().validAction);
+		}
+
+        cerr << "simule time " << start.diff(false) << " of " << budget << endl;
+		timeManager.spent(start.diff(false), settled);
+		timeManager.log();
+
+        if (action == 0) {
+            cerr << "mcts did not return any action" << endl;
+			action = game.playoutAction(rng);
+        }
+		cout << indexToPos[actionIndex(action)] << endl;
+		game.play(action);
+		playAll(workers, workerCount, action);
+		// off the critical path: the opponent is thinking
+		promoteAll(workers, workerCount);
+
+        workers[0].current->game().log();
+        cerr << endl;
+		first = false;
+		// getline(cin, str);
+    }
+}
@@ -0,0 +1,453 @@
+/*
+	Local referee of ultimate tic-tac-toe and engine-vs-engine tournament runner.
+
+	Every engine is a command run by /bin/sh, speaking the protocol of the CodinGame
+	referee on stdin/stdout: each turn it reads the last action of the opponent
+	("-1 -1" on the first turn of the first player), the number of valid actions and
+	one "row col" line per valid action, and answers one "row col" line.
+	The first player may play anywhere on its first turn.
+
+	Each reply is timed from the end of the input to the end of the line: a reply past
+	the time limit of its move is an overrun, counted, and lost with --forfeit. A reply
+	past the hard timeout, an illegal action or an engine exiting lose the game.
+
+	Games run in parallel, each with its own pair of processes, and the two engines
+	alternate the first move. The report gives the score of A with its 95% confidence
+	interval, the matching Elo difference, and the overruns and forfeits of each engine.
+
+	g++ -O2 -pthread referee.cpp -o referee
+	./referee "engine A" "engine B" [--games n] [--jobs n] [--first-time ms] [--move-time ms]
+	          [--hard-timeout ms] [--forfeit] [--verbose]
+	./referee "./mcts --puct 1" "./mcts --ucb1" --games 200 --jobs 8
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// wall clock, as the engines may be multi-threaded
+struct Timer {
+	chrono::steady_clock::time_point time_point;
+
+	Timer() { set(); }
+
+	void set() { time_point = chrono::steady_clock::now(); }
+
+	double diff() const { return chrono::duration<double, milli>(chrono::steady_clock::now() - time_point).count(); }
+};
+
+const int winLine[8][3] = {
+	{0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+	{0, 3, 6}, {1, 4, 7}, {2, 5, 8},
+	{0, 4, 8}, {2, 4, 6}
+};
+
+// winner of a 3x3 grid of owners, 0 if none
+int lineWinner(const int grid[9]) {
+	for (int i = 0; i < 8; i++) {
+		int owner = grid[winLine[i][0]];
+		if (owner != 0 && owner == grid[winLine[i][1]] && owner == grid[winLine[i][2]])
+			return owner;
+	}
+	return 0;
+}
+
+/*
+	Rules of the CodinGame referee, written apart from the engines' bitboards on purpose.
+	Players are 1 and 2, a small board is won (1, 2), drawn when full (DRAWN) or open (0).
+	The opponent must play in the small board at the place of the last action, anywhere
+	if it is closed. The game ends when a player completes a line of small boards, or when
+	no action is left: the player with the most small boards wins.
+*/
+struct Board {
+	static const int DRAWN = 3;
+
+	int cell[9][9]; // [small board][place in the small board]
+	int small[9];
+	int lastPlace;  // -1 before the first action
+
+	Board() : lastPlace(-1) {
+		memset(cell, 0, sizeof(cell));
+		memset(small, 0, sizeof(small));
+	}
+
+	static int boardOf(int row, int col) { return row / 3 * 3 + col / 3; }
+
+	static int placeOf(int row, int col) { return row % 3 * 3 + col % 3; }
+
+	// valid actions as (row, col), by row then column as the CodinGame referee lists them
+	vector<pair<int, int> > validActions() const {
+		vector<pair<int, int> > actions;
+		bool anywhere = lastPlace == -1 || small[lastPlace] != 0;
+		for (int row = 0; row < 9; row++) {
+			for (int col = 0; col < 9; col++) {
+				int board = boardOf(row, col);
+				if (small[board] == 0 && cell[board][placeOf(row, col)] == 0 && (anywhere || board == lastPlace))
+					actions.push_back(make_pair(row, col));
+			}
+		}
+		return actions;
+	}
+
+	void play(int row, int col, int player) {
+		int board = boardOf(row, col);
+		int place = placeOf(row, col);
+		cell[board][place] = player;
+		if (lineWinner(cell[board]) != 0)
+			small[board] = player;
+		else if (count(cell[board], cell[board] + 9, 0) == 0)
+			small[board] = DRAWN;
+		lastPlace = place;
+	}
+
+	// 1 or 2 for the winner, 0 for a draw, -1 while the game goes on
+	int winner() const {
+		int grid[9];
+		for (int i = 0; i < 9; i++)
+			grid[i] = small[i] == DRAWN ? 0 : small[i];
+		int lineOwner = lineWinner(grid);
+		if (lineOwner != 0)
+			return lineOwner;
+		if (!validActions().empty())
+			return -1;
+		int won1 = count(small, small + 9, 1);
+		int won2 = count(small, small + 9, 2);
+		return won1 > won2 ? 1 : won2 > won1 ? 2 : 0;
+	}
+};
+
+/*
+	An engine process, its stdin and stdout piped to the referee, its stderr discarded.
+	The shell may fork the engine rather than exec it (redirections, compound commands):
+	the engine leads its own process group, which stop() kills as a whole.
+*/
+struct Engine {
+	pid_t pid;
+	int input;
+	int output;
+	string buffer;
+
+	Engine() : pid(-1), input(-1), output(-1) {}
+
+	~Engine() { stop(); }
+
+	bool start(const string &command) {
+		int toEngine[2];
+		int fromEngine[2];
+		if (pipe(toEngine) != 0)
+			return false;
+		if (pipe(fromEngine) != 0) {
+			close(toEngine[0]);
+			close(toEngine[1]);
+			return false;
+		}
+		pid = fork();
+		if (pid == 0) {
+			setpgid(0, 0);
+			dup2(toEngine[0], 0);
+			dup2(fromEngine[1], 1);
+			int null = open("/dev/null", O_WRONLY);
+			dup2(null, 2);
+			close(null);
+			close(toEngine[0]);
+			close(toEngine[1]);
+			close(fromEngine[0]);
+			close(fromEngine[1]);
+			execl("/bin/sh", "sh", "-c", command.c_str(), (char *)NULL);
+			_exit(127);
+		}
+		// also set here, so that stop() finds the group even before the child runs
+		if (pid > 0)
+			setpgid(pid, pid);
+		close(toEngine[0]);
+		close(fromEngine[1]);
+		input = toEngine[1];
+		output = fromEngine[0];
+		return pid > 0;
+	}
+
+	// false if the engine does not read anymore
+	bool send(const string &text) {
+		size_t sent = 0;
+		while (sent < text.size()) {
+			ssize_t n = write(input, text.data() + sent, text.size() - sent);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	// 1 with a line, 0 if the engine closed its output, -1 past timeout ms
+	int readLine(string &line, double timeout) {
+		Timer start;
+		while (true) {
+			size_t end = buffer.find('\n');
+			if (end != string::npos) {
+				line = buffer.substr(0, end);
+				buffer.erase(0, end + 1);
+				return 1;
+			}
+			double left = timeout - start.diff();
+			if (left <= 0)
+				return -1;
+			struct pollfd fd = { output, POLLIN, 0 };
+			int ready = poll(&fd, 1, int(ceil(left)));
+			if (ready < 0 && errno == EINTR)
+				continue;
+			if (ready <= 0)
+				continue;
+			char chunk[256];
+			ssize_t n = read(output, chunk, sizeof(chunk));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return 0;
+			buffer.append(chunk, n);
+		}
+	}
+
+	void stop() {
+		if (pid > 0) {
+			kill(-pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			pid = -1;
+		}
+		if (input >= 0)
+			close(input);
+		if (output >= 0)
+			close(output);
+		input = output = -1;
+	}
+};
+
+struct Settings {
+	string command[2];
+	int games;
+	int jobs;
+	double firstMoveTime;
+	double moveTime;
+	double hardTimeout;
+	bool forfeit;
+	bool verbose;
+
+	Settings() : games(100), jobs(max(1u, thread::hardware_concurrency())), firstMoveTime(1000), moveTime(100), hardTimeout(5000), forfeit(false), verbose(false) {}
+};
+
+enum Forfeit { NONE, CRASH, ILLEGAL, TIMEOUT, OVERRUN };
+
+const char *forfeitName[] = {"", "crash", "illegal action", "timeout", "overrun"};
+
+// what happened to one engine in one game
+struct Side {
+	int overrunCount;
+	double maxFirstMoveTime;
+	double maxMoveTime;
+	Forfeit forfeit;
+
+	Side() : overrunCount(0), maxFirstMoveTime(0), maxMoveTime(0), forfeit(NONE) {}
+};
+
+struct GameResult {
+	int winner; // engine 0 (A) or 1 (B), -1 for a draw
+	Side side[2];
+};
+
+// a game where engine first plays first
+GameResult playGame(const Settings &settings, int first) {
+	GameResult result;
+	Engine engine[2];
+	for (int e = 0; e < 2; e++) {
+		if (!engine[e].start(settings.command[e])) {
+			result.side[e].forfeit = CRASH;
+			result.winner = 1 - e;
+			return result;
+		}
+	}
+
+	Board board;
+	int lastRow = -1;
+	int lastCol = -1;
+	int turn[2] = {0, 0};
+	// players of the board are 1 for the first engine and 2 for the other one
+	int current = first;
+	while (board.winner() == -1) {
+		Side &side = result.side[current];
+		vector<pair<int, int> > actions = board.validActions();
+		string text = to_string(lastRow) + " " + to_string(lastCol) + "\n" + to_string(actions.size()) + "\n";
+		for (size_t i = 0; i < actions.size(); i++)
+			text += to_string(actions[i].first) + " " + to_string(actions[i].second) + "\n";
+
+		string line;
+		Timer start;
+		int status = engine[current].send(text) ? engine[current].readLine(line, settings.hardTimeout) : 0;
+		double time = start.diff();
+		double limit = turn[current] == 0 ? settings.firstMoveTime : settings.moveTime;
+		if (turn[current] == 0)
+			side.maxFirstMoveTime = max(side.maxFirstMoveTime, time);
+		else
+			side.maxMoveTime = max(side.maxMoveTime, time);
+		turn[current]++;
+
+		int row = -1;
+		int col = -1;
+		if (status == 0)
+			side.forfeit = CRASH;
+		else if (status < 0)
+			side.forfeit = TIMEOUT;
+		else if (sscanf(line.c_str(), "%d %d", &row, &col) != 2 || find(actions.begin(), actions.end(), make_pair(row, col)) == actions.end())
+			side.forfeit = ILLEGAL;
+		else if (time > limit) {
+			side.overrunCount++;
+			if (settings.forfeit)
+				side.forfeit = OVERRUN;
+		}
+		if (side.forfeit != NONE) {
+			result.winner = 1 - current;
+			return result;
+		}
+
+		board.play(row, col, current == first ? 1 : 2);
+		lastRow = row;
+		lastCol = col;
+		current = 1 - current;
+	}
+	int winner = board.winner();
+	result.winner = winner == 0 ? -1 : winner == 1 ? first : 1 - first;
+	return result;
+}
+
+// totals of the tournament, for engine A and engine B
+struct Tournament {
+	int gameCount;
+	int wins[2];
+	int draws;
+	int overrunCount[2];
+	int forfeitCount[2][5];
+	double maxFirstMoveTime[2];
+	double maxMoveTime[2];
+	mutex lock;
+
+	Tournament() : gameCount(0), draws(0) {
+		for (int e = 0; e < 2; e++) {
+			wins[e] = 0;
+			overrunCount[e] = 0;
+			maxFirstMoveTime[e] = 0;
+			maxMoveTime[e] = 0;
+			memset(forfeitCount[e], 0, sizeof(forfeitCount[e]));
+		}
+	}
+
+	void add(const GameResult &result, int game, bool verbose) {
+		lock_guard<mutex> guard(lock);
+		gameCount++;
+		if (result.winner < 0)
+			draws++;
+		else
+			wins[result.winner]++;
+		for (int e = 0; e < 2; e++) {
+			const Side &side = result.side[e];
+			overrunCount[e] += side.overrunCount;
+			forfeitCount[e][side.forfeit]++;
+			maxFirstMoveTime[e] = max(maxFirstMoveTime[e], side.maxFirstMoveTime);
+			maxMoveTime[e] = max(maxMoveTime[e], side.maxMoveTime);
+		}
+		if (verbose) {
+			cerr << "game " << game << " (" << (game % 2 == 0 ? "A" : "B") << " first): " << (result.winner < 0 ? "draw" : result.winner == 0 ? "A wins" : "B wins");
+			for (int e = 0; e < 2; e++) {
+				if (result.side[e].forfeit != NONE)
+					cerr << ", " << (e == 0 ? "A" : "B") << " " << forfeitName[result.side[e].forfeit];
+			}
+			cerr << endl;
+		}
+	}
+
+	static double elo(double score) { return 400 * log10(score / (1 - score)); }
+
+	void report(const Settings &settings) {
+		// a game scores 1, 0.5 or 0 for A: the interval is the normal one on the mean score
+		double score = (wins[0] + 0.5 * draws) / gameCount;
+		double square = (wins[0] + 0.25 * draws) / gameCount;
+		double margin = 1.96 * sqrt(max(0.0, square - score * score) / gameCount);
+		double low = min(max(score - margin, 0.001), 0.999);
+		double high = min(max(score + margin, 0.001), 0.999);
+
+		cout << fixed << setprecision(1);
+		cout << "games " << gameCount << ": A " << wins[0] << " wins, B " << wins[1] << " wins, " << draws << " draws" << endl;
+		cout << setprecision(3) << "score of A " << score << " +- " << margin << " (95%)";
+		cout << setprecision(0) << ", elo " << elo(min(max(score, 0.001), 0.999)) << " [" << elo(low) << ", " << elo(high) << "]" << endl;
+		for (int e = 0; e < 2; e++) {
+			cout << (e == 0 ? "A" : "B") << " \"" << settings.command[e] << "\": ";
+			cout << setprecision(1) << overrunCount[e] << " overruns, max " << maxFirstMoveTime[e] << " ms on a first move, " << maxMoveTime[e] << " ms on the others";
+			for (int f = CRASH; f <= OVERRUN; f++) {
+				if (forfeitCount[e][f] > 0)
+					cout << ", " << forfeitCount[e][f] << " lost by " << forfeitName[f];
+			}
+			cout << endl;
+		}
+	}
+};
+
+int main(int ac, char *av[]) {
+	Settings settings;
+	int commandCount = 0;
+	for (int i = 1; i < ac; i++) {
+		string arg(av[i]);
+		if (arg == "--games" && i + 1 < ac)
+			settings.games = max(1, atoi(av[++i]));
+		else if (arg == "--jobs" && i + 1 < ac)
+			settings.jobs = max(1, atoi(av[++i]));
+		else if (arg == "--first-time" && i + 1 < ac)
+			settings.firstMoveTime = atof(av[++i]);
+		else if (arg == "--move-time" && i + 1 < ac)
+			settings.moveTime = atof(av[++i]);
+		else if (arg == "--hard-timeout" && i + 1 < ac)
+			settings.hardTimeout = atof(av[++i]);
+		else if (arg == "--forfeit")
+			settings.forfeit = true;
+		else if (arg == "--verbose")
+			settings.verbose = true;
+		else if (commandCount < 2)
+			settings.command[commandCount++] = arg;
+	}
+	if (commandCount < 2) {
+		cerr << "usage: ./referee \"engine A\" \"engine B\" [--games n] [--jobs n] [--first-time ms] [--move-time ms] [--hard-timeout ms] [--forfeit] [--verbose]" << endl;
+		return 1;
+	}
+	// an engine exiting must not kill the referee writing to it
+	signal(SIGPIPE, SIG_IGN);
+
+	Tournament tournament;
+	atomic<int> next(0);
+	vector<thread> threads;
+	for (int j = 0; j < min(settings.jobs, settings.games); j++) {
+		threads.push_back(thread([&]() {
+			for (int game = next++; game < settings.games; game = next++)
+				tournament.add(playGame(settings, game % 2), game, settings.verbose);
+		}));
+	}
+	for (size_t j = 0; j < threads.size(); j++)
+		threads[j].join();
+
+	tournament.report(settings);
+	return 0;
+}